@@ -0,0 +1,535 @@
+#include "BlockCompression.h"
+#include <math.h>
+#include <string.h>
+#include <vector>
+#include "../thread_pool.h"
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define TC500_BC_SSE2
+#include <immintrin.h>
+#endif
+
+namespace TChapman500 {
+namespace Graphics {
+
+static inline int Clamp255(int value) { return value < 0 ? 0 : value > 255 ? 255 : value; }
+
+static inline unsigned short To565(const int *color)
+{
+	int r = (Clamp255(color[0]) * 31 + 127) / 255;
+	int g = (Clamp255(color[1]) * 63 + 127) / 255;
+	int b = (Clamp255(color[2]) * 31 + 127) / 255;
+	return (unsigned short)((r << 11) | (g << 5) | b);
+}
+
+static inline void From565(unsigned short value, int *color)
+{
+	int r = (value >> 11) & 31;
+	int g = (value >> 5) & 63;
+	int b = value & 31;
+	color[0] = (r << 3) | (r >> 2);
+	color[1] = (g << 2) | (g >> 4);
+	color[2] = (b << 3) | (b >> 2);
+}
+
+// Colors a decoder makes from two endpoints.  With three colors the last entry is transparent.
+static void ColorPalette(unsigned short c0, unsigned short c1, bool fourColor, int palette[4][3])
+{
+	From565(c0, palette[0]);
+	From565(c1, palette[1]);
+	for (unsigned c = 0; c < 3; c++)
+	{
+		if (fourColor)
+		{
+			palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+			palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+		}
+		else
+		{
+			palette[2][c] = (palette[0][c] + palette[1][c]) / 2;
+			palette[3][c] = 0;
+		}
+	}
+}
+
+// Nearest of the first colorCount palette entries for each pixel, two bits each, and the total
+// squared error.  Transparent pixels are given index 3 and do not count.
+static unsigned ColorIndices(const unsigned char *pixels, const int palette[4][3], unsigned colorCount, unsigned transparent, unsigned &error)
+{
+	unsigned best[16];
+	unsigned distance[16];
+#ifdef TC500_BC_SSE2
+	// Two pixels per register as 16-bit RGB0.  Squared differences summed by madd, then pairs.
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i colorMask = _mm_set1_epi32(0x00FFFFFF);
+	__m128i entries[4];
+	for (unsigned k = 0; k < colorCount; k++)
+		entries[k] = _mm_setr_epi16((short)palette[k][0], (short)palette[k][1], (short)palette[k][2], 0, (short)palette[k][0], (short)palette[k][1], (short)palette[k][2], 0);
+
+	for (unsigned group = 0; group < 4; group++)
+	{
+		__m128i colors = _mm_and_si128(_mm_loadu_si128((const __m128i *)(pixels + group * 16)), colorMask);
+		__m128i low = _mm_unpacklo_epi8(colors, zero);
+		__m128i high = _mm_unpackhi_epi8(colors, zero);
+
+		__m128i bestDistance = _mm_setzero_si128();
+		__m128i bestIndex = _mm_setzero_si128();
+		for (unsigned k = 0; k < colorCount; k++)
+		{
+			__m128i lowDiff = _mm_sub_epi16(low, entries[k]);
+			__m128i highDiff = _mm_sub_epi16(high, entries[k]);
+			__m128i lowSum = _mm_madd_epi16(lowDiff, lowDiff);
+			__m128i highSum = _mm_madd_epi16(highDiff, highDiff);
+			lowSum = _mm_add_epi32(lowSum, _mm_shuffle_epi32(lowSum, _MM_SHUFFLE(2, 3, 0, 1)));
+			highSum = _mm_add_epi32(highSum, _mm_shuffle_epi32(highSum, _MM_SHUFFLE(2, 3, 0, 1)));
+			__m128i sum = _mm_castps_si128(_mm_shuffle_ps(_mm_castsi128_ps(lowSum), _mm_castsi128_ps(highSum), _MM_SHUFFLE(2, 0, 2, 0)));
+			if (k == 0)
+			{
+				bestDistance = sum;
+				continue;
+			}
+
+			__m128i closer = _mm_cmplt_epi32(sum, bestDistance);
+			bestDistance = _mm_or_si128(_mm_and_si128(closer, sum), _mm_andnot_si128(closer, bestDistance));
+			bestIndex = _mm_or_si128(_mm_and_si128(closer, _mm_set1_epi32((int)k)), _mm_andnot_si128(closer, bestIndex));
+		}
+		_mm_storeu_si128((__m128i *)(best + group * 4), bestIndex);
+		_mm_storeu_si128((__m128i *)(distance + group * 4), bestDistance);
+	}
+#else
+	for (unsigned i = 0; i < 16; i++)
+	{
+		for (unsigned k = 0; k < colorCount; k++)
+		{
+			unsigned sum = 0;
+			for (unsigned c = 0; c < 3; c++)
+			{
+				int diff = pixels[i * 4 + c] - palette[k][c];
+				sum += diff * diff;
+			}
+			if (k == 0 || sum < distance[i])
+			{
+				distance[i] = sum;
+				best[i] = k;
+			}
+		}
+	}
+#endif
+
+	unsigned indices = 0;
+	error = 0;
+	for (unsigned i = 0; i < 16; i++)
+	{
+		if (transparent & (1 << i))
+		{
+			indices |= 3u << (i * 2);
+			continue;
+		}
+		indices |= best[i] << (i * 2);
+		error += distance[i];
+	}
+	return indices;
+}
+
+// How far along from the second endpoint to the first each index is.
+static const float FourColorWeights[4] = { 1.0f, 0.0f, 2.0f / 3.0f, 1.0f / 3.0f };
+static const float ThreeColorWeights[4] = { 1.0f, 0.0f, 0.5f, 0.0f };
+
+// Least-squares endpoints for the indices already chosen.  False if the indices cannot decide
+// them, such as when every pixel uses the same one.
+static bool RefineEndpoints(const unsigned char *pixels, unsigned indices, bool fourColor, unsigned transparent, int first[3], int second[3])
+{
+	const float *weights = fourColor ? FourColorWeights : ThreeColorWeights;
+	float aa = 0.0f, ab = 0.0f, bb = 0.0f;
+	float ax[3] = { 0.0f, 0.0f, 0.0f };
+	float bx[3] = { 0.0f, 0.0f, 0.0f };
+	for (unsigned i = 0; i < 16; i++)
+	{
+		if (transparent & (1 << i)) continue;
+		float a = weights[(indices >> (i * 2)) & 3];
+		float b = 1.0f - a;
+		aa += a * a;
+		ab += a * b;
+		bb += b * b;
+		for (unsigned c = 0; c < 3; c++)
+		{
+			ax[c] += a * pixels[i * 4 + c];
+			bx[c] += b * pixels[i * 4 + c];
+		}
+	}
+
+	float determinant = aa * bb - ab * ab;
+	if (fabsf(determinant) < 1e-6f) return false;
+	for (unsigned c = 0; c < 3; c++)
+	{
+		first[c] = (int)lrintf((ax[c] * bb - bx[c] * ab) / determinant);
+		second[c] = (int)lrintf((bx[c] * aa - ax[c] * ab) / determinant);
+	}
+	return true;
+}
+
+// Endpoints from the corners of the box around the opaque colors, pulled in a little since
+// the extremes are rarely worth matching exactly.  Red and blue go along or against green
+// depending on which way they vary together.
+static void BoxEndpoints(const unsigned char *pixels, unsigned transparent, int first[3], int second[3])
+{
+	int low[3] = { 255, 255, 255 };
+	int high[3] = { 0, 0, 0 };
+	int mean[3] = { 0, 0, 0 };
+	int count = 0;
+	for (unsigned i = 0; i < 16; i++)
+	{
+		if (transparent & (1 << i)) continue;
+		for (unsigned c = 0; c < 3; c++)
+		{
+			int value = pixels[i * 4 + c];
+			if (value < low[c]) low[c] = value;
+			if (value > high[c]) high[c] = value;
+			mean[c] += value;
+		}
+		count++;
+	}
+	for (unsigned c = 0; c < 3; c++) mean[c] = count ? mean[c] / count : 0;
+
+	int covariance[3] = { 0, 0, 0 };
+	for (unsigned i = 0; i < 16; i++)
+	{
+		if (transparent & (1 << i)) continue;
+		int green = pixels[i * 4 + 1] - mean[1];
+		covariance[0] += (pixels[i * 4] - mean[0]) * green;
+		covariance[2] += (pixels[i * 4 + 2] - mean[2]) * green;
+	}
+
+	for (unsigned c = 0; c < 3; c++)
+	{
+		int inset = (high[c] - low[c]) >> 4;
+		first[c] = high[c] - inset;
+		second[c] = low[c] + inset;
+	}
+	if (covariance[0] < 0) std::swap(first[0], second[0]);
+	if (covariance[2] < 0) std::swap(first[2], second[2]);
+}
+
+// Endpoints at the ends of the line through the opaque colors that fits them best.
+static void AxisEndpoints(const unsigned char *pixels, unsigned transparent, int first[3], int second[3])
+{
+	float mean[3] = { 0.0f, 0.0f, 0.0f };
+	int count = 0;
+	for (unsigned i = 0; i < 16; i++)
+	{
+		if (transparent & (1 << i)) continue;
+		for (unsigned c = 0; c < 3; c++) mean[c] += pixels[i * 4 + c];
+		count++;
+	}
+	if (!count) count = 1;
+	for (unsigned c = 0; c < 3; c++) mean[c] /= count;
+
+	float covariance[6] = { 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f };
+	for (unsigned i = 0; i < 16; i++)
+	{
+		if (transparent & (1 << i)) continue;
+		float r = pixels[i * 4] - mean[0];
+		float g = pixels[i * 4 + 1] - mean[1];
+		float b = pixels[i * 4 + 2] - mean[2];
+		covariance[0] += r * r;
+		covariance[1] += r * g;
+		covariance[2] += r * b;
+		covariance[3] += g * g;
+		covariance[4] += g * b;
+		covariance[5] += b * b;
+	}
+
+	// Power iteration finds the main axis.
+	float axis[3] = { 1.0f, 1.0f, 1.0f };
+	for (unsigned step = 0; step < 8; step++)
+	{
+		float next[3] = {
+			covariance[0] * axis[0] + covariance[1] * axis[1] + covariance[2] * axis[2],
+			covariance[1] * axis[0] + covariance[3] * axis[1] + covariance[4] * axis[2],
+			covariance[2] * axis[0] + covariance[4] * axis[1] + covariance[5] * axis[2]
+		};
+		float length = fabsf(next[0]) > fabsf(next[1]) ? fabsf(next[0]) : fabsf(next[1]);
+		if (fabsf(next[2]) > length) length = fabsf(next[2]);
+		if (length < 1e-6f) break;
+		for (unsigned c = 0; c < 3; c++) axis[c] = next[c] / length;
+	}
+
+	float low = 1e9f, high = -1e9f;
+	for (unsigned i = 0; i < 16; i++)
+	{
+		if (transparent & (1 << i)) continue;
+		float t = (pixels[i * 4] - mean[0]) * axis[0] + (pixels[i * 4 + 1] - mean[1]) * axis[1] + (pixels[i * 4 + 2] - mean[2]) * axis[2];
+		if (t < low) low = t;
+		if (t > high) high = t;
+	}
+	float lengthSquared = axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2];
+	if (lengthSquared < 1e-6f) lengthSquared = 1.0f;
+	for (unsigned c = 0; c < 3; c++)
+	{
+		first[c] = (int)lrintf(mean[c] + axis[c] * high / lengthSquared);
+		second[c] = (int)lrintf(mean[c] + axis[c] * low / lengthSquared);
+	}
+}
+
+struct color_block
+{
+	unsigned short Color0;
+	unsigned short Color1;
+	unsigned Indices;
+	unsigned Error;
+};
+
+// Try a pair of endpoints, keeping it if it beats the best so far.
+static void TryEndpoints(const unsigned char *pixels, const int first[3], const int second[3], bool fourColor, unsigned transparent, color_block &best)
+{
+	color_block block;
+	block.Color0 = To565(first);
+	block.Color1 = To565(second);
+
+	int palette[4][3];
+	ColorPalette(block.Color0, block.Color1, fourColor, palette);
+	block.Indices = ColorIndices(pixels, palette, fourColor ? 4 : 3, transparent, block.Error);
+	if (block.Error < best.Error) best = block;
+}
+
+// Put the endpoints in the order that tells a decoder which mode the block is in, swapping
+// indices to match.  Four colors need the first endpoint above the second, three the opposite.
+static void OrderEndpoints(color_block &block, bool fourColor, unsigned transparent)
+{
+	if (block.Color0 == block.Color1)
+	{
+		// Either order is the same color, so only the first entry is ever needed.
+		block.Indices = 0;
+		for (unsigned i = 0; i < 16; i++)
+			if (transparent & (1 << i)) block.Indices |= 3u << (i * 2);
+		return;
+	}
+
+	bool swap = fourColor ? block.Color0 < block.Color1 : block.Color0 > block.Color1;
+	if (!swap) return;
+	std::swap(block.Color0, block.Color1);
+
+	// Four colors: 0 and 1 trade places, and so do 2 and 3.  Three colors: only 0 and 1.
+	unsigned flip = fourColor ? 0x55555555 : 0;
+	for (unsigned i = 0; i < 16; i++)
+	{
+		unsigned index = (block.Indices >> (i * 2)) & 3;
+		if (!fourColor && index < 2) flip |= 1u << (i * 2);
+	}
+	block.Indices ^= flip;
+}
+
+static void CompressColor(unsigned char *dest, const unsigned char *pixels, compression_quality quality, bool fourColor, unsigned transparent)
+{
+	color_block best;
+	best.Color0 = 0;
+	best.Color1 = 0;
+	best.Indices = 0;
+	best.Error = ~0u;
+
+	int first[3], second[3];
+	if (transparent == 0xFFFF)
+	{
+		best.Indices = 0xFFFFFFFF;
+	}
+	else
+	{
+		BoxEndpoints(pixels, transparent, first, second);
+		TryEndpoints(pixels, first, second, fourColor, transparent, best);
+
+		if (quality == compression_quality::High)
+		{
+			AxisEndpoints(pixels, transparent, first, second);
+			TryEndpoints(pixels, first, second, fourColor, transparent, best);
+
+			// Fit the endpoints to the indices, then the indices to the endpoints, a few times.
+			for (unsigned step = 0; step < 3; step++)
+			{
+				unsigned error = best.Error;
+				if (!RefineEndpoints(pixels, best.Indices, fourColor, transparent, first, second)) break;
+				TryEndpoints(pixels, first, second, fourColor, transparent, best);
+				if (best.Error >= error) break;
+			}
+		}
+		OrderEndpoints(best, fourColor, transparent);
+	}
+
+	dest[0] = (unsigned char)best.Color0;
+	dest[1] = (unsigned char)(best.Color0 >> 8);
+	dest[2] = (unsigned char)best.Color1;
+	dest[3] = (unsigned char)(best.Color1 >> 8);
+	for (unsigned i = 0; i < 4; i++) dest[4 + i] = (unsigned char)(best.Indices >> (i * 8));
+}
+
+// Nearest of the eight alpha values for each pixel, three bits each, and the squared error.
+static unsigned long long AlphaIndices(const unsigned char *pixels, const int values[8], unsigned &error)
+{
+	unsigned long long indices = 0;
+	error = 0;
+	for (unsigned i = 0; i < 16; i++)
+	{
+		int alpha = pixels[i * 4 + 3];
+		unsigned best = 0;
+		int bestDiff = 256;
+		for (unsigned k = 0; k < 8; k++)
+		{
+			int diff = alpha > values[k] ? alpha - values[k] : values[k] - alpha;
+			if (diff < bestDiff)
+			{
+				bestDiff = diff;
+				best = k;
+			}
+		}
+		indices |= (unsigned long long)best << (i * 3);
+		error += bestDiff * bestDiff;
+	}
+	return indices;
+}
+
+static void CompressAlpha(unsigned char *dest, const unsigned char *pixels, compression_quality quality)
+{
+	int low = 255, high = 0;
+	int innerLow = 255, innerHigh = 0;
+	for (unsigned i = 0; i < 16; i++)
+	{
+		int alpha = pixels[i * 4 + 3];
+		if (alpha < low) low = alpha;
+		if (alpha > high) high = alpha;
+		if (alpha != 0 && alpha != 255)
+		{
+			if (alpha < innerLow) innerLow = alpha;
+			if (alpha > innerHigh) innerHigh = alpha;
+		}
+	}
+
+	// Eight values spread between the two endpoints.
+	int values[8];
+	int alpha0 = high, alpha1 = low;
+	values[0] = alpha0;
+	values[1] = alpha1;
+	for (int i = 2; i < 8; i++) values[i] = ((8 - i) * alpha0 + (i - 1) * alpha1) / 7;
+	unsigned error;
+	unsigned long long indices = AlphaIndices(pixels, values, error);
+
+	// Six values between the endpoints plus exact 0 and 255, which suits blocks with hard
+	// edges as well as soft ones.
+	if (quality == compression_quality::High && error && innerLow <= innerHigh)
+	{
+		int inner[8];
+		inner[0] = innerLow;
+		inner[1] = innerHigh;
+		for (int i = 2; i < 6; i++) inner[i] = ((6 - i) * innerLow + (i - 1) * innerHigh) / 5;
+		inner[6] = 0;
+		inner[7] = 255;
+
+		unsigned innerError;
+		unsigned long long innerIndices = AlphaIndices(pixels, inner, innerError);
+		if (innerError < error)
+		{
+			alpha0 = innerLow;
+			alpha1 = innerHigh;
+			indices = innerIndices;
+		}
+	}
+
+	dest[0] = (unsigned char)alpha0;
+	dest[1] = (unsigned char)alpha1;
+	for (unsigned i = 0; i < 6; i++) dest[2 + i] = (unsigned char)(indices >> (i * 8));
+}
+
+void CompressBlockBC1(unsigned char *dest, const unsigned char *pixels, compression_quality quality)
+{
+	unsigned transparent = 0;
+	for (unsigned i = 0; i < 16; i++)
+		if (pixels[i * 4 + 3] < 128) transparent |= 1 << i;
+
+	// Only three colors are left when some pixels need to be transparent.
+	CompressColor(dest, pixels, quality, transparent == 0, transparent);
+}
+
+void CompressBlockBC3(unsigned char *dest, const unsigned char *pixels, compression_quality quality)
+{
+	CompressAlpha(dest, pixels, quality);
+	CompressColor(dest + 8, pixels, quality, true, 0);
+}
+
+// Copy one 4x4 block out of an image, repeating the last row and column past the edge.
+static void ReadBlock(unsigned char *block, const unsigned char *image, unsigned width, unsigned height, unsigned blockX, unsigned blockY, bool bgra)
+{
+	for (unsigned y = 0; y < 4; y++)
+	{
+		unsigned row = blockY * 4 + y < height ? blockY * 4 + y : height - 1;
+		for (unsigned x = 0; x < 4; x++)
+		{
+			unsigned column = blockX * 4 + x < width ? blockX * 4 + x : width - 1;
+			const unsigned char *pixel = image + ((size_t)row * width + column) * 4;
+			unsigned char *out = block + (y * 4 + x) * 4;
+			out[0] = pixel[bgra ? 2 : 0];
+			out[1] = pixel[1];
+			out[2] = pixel[bgra ? 0 : 2];
+			out[3] = pixel[3];
+		}
+	}
+}
+
+bool CompressTexture(texture_data &source, texture_data &dest, texture_format format, compression_quality quality, texture_pool *pool)
+{
+	// dest is emptied before anything is read from source.
+	if (&source == &dest) return false;
+	if (format != texture_format::DXT1 && format != texture_format::DXT5) return false;
+	if (source.Format != texture_format::RGBA_8888 && source.Format != texture_format::BGRA_8888) return false;
+	if (!source.Data || !source.Mips || !source.MipCount) return false;
+	for (unsigned mip = 0; mip < source.MipCount; mip++)
+		if (!source.Mips[mip].Width || !source.Mips[mip].Height || source.Mips[mip].BytesPerRow != source.Mips[mip].Width * 4) return false;
+
+	unsigned blockSize = format == texture_format::DXT1 ? 8 : 16;
+	dest.initialize(source.MipCount, source.ArrayCount);
+	if (!dest.Mips) return false;
+	dest.Width = source.Width;
+	dest.Height = source.Height;
+	dest.Format = format;
+	dest.CubeMap = source.CubeMap;
+	dest.Transparent = source.Transparent;
+	for (unsigned mip = 0; mip < source.MipCount; mip++)
+	{
+		dest.Mips[mip].Width = source.Mips[mip].Width;
+		dest.Mips[mip].Height = source.Mips[mip].Height;
+		dest.Mips[mip].BytesPerRow = (source.Mips[mip].Width + 3) / 4 * blockSize;
+		dest.Mips[mip].DataSize = dest.Mips[mip].BytesPerRow * ((source.Mips[mip].Height + 3) / 4);
+	}
+	if (!dest.generate_data(pool)) return false;
+
+	// Every row of blocks in every image is a separate piece of work.
+	struct block_row
+	{
+		unsigned Element;
+		unsigned Mip;
+		unsigned Row;
+	};
+	std::vector<block_row> rows;
+	for (unsigned element = 0; element < source.ArrayCount; element++)
+	{
+		for (unsigned mip = 0; mip < source.MipCount; mip++)
+			for (unsigned row = 0; row < (source.Mips[mip].Height + 3) / 4; row++) rows.push_back(block_row{ element, mip, row });
+	}
+
+	bool bgra = source.Format == texture_format::BGRA_8888;
+	thread_pool::shared().parallel_for(rows.size(), 4, [&](size_t begin, size_t end) {
+		unsigned char block[64];
+		for (size_t i = begin; i < end; i++)
+		{
+			const block_row &work = rows[i];
+			const mip_data &mip = source.Mips[work.Mip];
+			const unsigned char *image = source.get_data(work.Mip, work.Element);
+			unsigned char *out = dest.get_data(work.Mip, work.Element) + (size_t)work.Row * dest.Mips[work.Mip].BytesPerRow;
+			for (unsigned x = 0; x < (mip.Width + 3) / 4; x++)
+			{
+				ReadBlock(block, image, mip.Width, mip.Height, x, work.Row, bgra);
+				if (blockSize == 8) CompressBlockBC1(out + x * 8, block, quality);
+				else CompressBlockBC3(out + x * 16, block, quality);
+			}
+		}
+	});
+	return true;
+}
+
+}}
@@ -0,0 +1,26 @@
+#pragma once
+#include "Graphics.h"
+
+namespace TChapman500 {
+namespace Graphics {
+
+enum class compression_quality
+{
+	Fast,		// Endpoints from the corners of each block's color box.
+	High		// Endpoints along each block's main color axis, then refined to fit its pixels.
+};
+
+// Compress every mip of every array element of an RGBA_8888 or BGRA_8888 texture into dest as
+// DXT1 (BC1) or DXT5 (BC3).  DXT1 blocks with pixels whose alpha is under 128 make those pixels
+// fully transparent.  Edge blocks of sizes that are not a multiple of 4 repeat the last row and
+// column.  Rows of blocks are compressed at the same time on the shared thread pool.  Storage
+// for dest is taken from the pool if one is given, and anything dest held before is freed.
+// source and dest must be different textures.
+bool CompressTexture(texture_data &source, texture_data &dest, texture_format format, compression_quality quality = compression_quality::Fast, texture_pool *pool = nullptr);
+
+// Compress one block of 4x4 RGBA pixels, in rows.  BC1 blocks are 8 bytes and BC3 blocks 16.
+// Uses SSE2 when it is available.
+void CompressBlockBC1(unsigned char *dest, const unsigned char *pixels, compression_quality quality);
+void CompressBlockBC3(unsigned char *dest, const unsigned char *pixels, compression_quality quality);
+
+}}
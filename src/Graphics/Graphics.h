@@ -1,6 +1,10 @@
 #pragma once
 #include <d3d11.h>
 #include <memory>
+#include <mutex>
+#include <new>
+#include <unordered_map>
+#include <vector>
 
 namespace TChapman500 {
 namespace Graphics {
@@ -21,6 +25,75 @@ struct mip_data
 	unsigned DataSize;
 };
 
+// Keeps the storage of freed textures so that the next texture of the same size can take it
+// instead of allocating.  Handy when loading many textures of a few sizes, or when loading and
+// freeing them over and over.  The pool must outlive every texture_data that takes storage
+// from it.  Safe to use from several threads at once.
+class texture_pool
+{
+public:
+	// At most maxBytes of free storage is kept.  Anything past that is freed right away.
+	inline texture_pool(size_t maxBytes = 256 * 1024 * 1024) : MaxBytes(maxBytes) {}
+	inline ~texture_pool() { trim(); }
+
+	texture_pool(const texture_pool &) = delete;
+	texture_pool &operator=(const texture_pool &) = delete;
+
+	// Every block is aligned to this, and so is every image inside it.
+	static const size_t Alignment = 64;
+
+	inline static unsigned char *allocate(size_t size) { return (unsigned char *)::operator new(size, std::align_val_t(Alignment), std::nothrow); }
+	inline static void deallocate(unsigned char *block) { ::operator delete(block, std::align_val_t(Alignment)); }
+
+	// A block of exactly size bytes, reused if one was kept.
+	inline unsigned char *acquire(size_t size)
+	{
+		{
+			std::lock_guard<std::mutex> lock(Mutex);
+			auto found = Free.find(size);
+			if (found != Free.end() && !found->second.empty())
+			{
+				unsigned char *block = found->second.back();
+				found->second.pop_back();
+				Kept -= size;
+				return block;
+			}
+		}
+		return allocate(size);
+	}
+
+	// Give back a block from acquire() of the same size.
+	inline void release(unsigned char *block, size_t size)
+	{
+		{
+			std::lock_guard<std::mutex> lock(Mutex);
+			if (Kept + size <= MaxBytes)
+			{
+				Free[size].push_back(block);
+				Kept += size;
+				return;
+			}
+		}
+		deallocate(block);
+	}
+
+	// Free everything being kept.
+	inline void trim()
+	{
+		std::lock_guard<std::mutex> lock(Mutex);
+		for (auto &blocks : Free)
+			for (unsigned char *block : blocks.second) deallocate(block);
+		Free.clear();
+		Kept = 0;
+	}
+
+private:
+	std::mutex Mutex;
+	std::unordered_map<size_t, std::vector<unsigned char *>> Free;
+	size_t Kept = 0;
+	size_t MaxBytes;
+};
+
 struct texture_data
 {
 	unsigned Width;
@@ -34,17 +107,28 @@ struct texture_data
 	mip_data *Mips;
 	unsigned char **Data;
 
+	// All images live in one block, after the Data table.  Each one starts on a new cache line.
+	unsigned char *Storage;
+	size_t StorageSize;
+	texture_pool *Pool;
+
 	inline texture_data()
 	{
 		Mips = nullptr;
 		Data = nullptr;
+		Storage = nullptr;
+		StorageSize = 0;
+		Pool = nullptr;
 	}
 
+	// Anything the texture already held is freed first, so a texture can be filled again.
 	inline void initialize(unsigned mipCount, unsigned arrayCount)
 	{
+		delete[] Mips;
+		Mips = nullptr;
+		delete_data();
 		ArrayCount = arrayCount;
 		MipCount = mipCount;
-		Data = nullptr;
 
 		try
 		{
@@ -54,73 +138,64 @@ struct texture_data
 		catch (std::bad_alloc) { Mips = nullptr; }
 	}
 
-	inline bool generate_data()
+	inline static size_t align(size_t size) { return (size + texture_pool::Alignment - 1) & ~(texture_pool::Alignment - 1); }
+
+	// Where each mip of an array element starts, counting from the first image.  Mips of an
+	// element follow each other, and elements follow each other.
+	inline size_t get_offset(unsigned mipIndex, unsigned arrayIndex)
+	{
+		size_t elementSize = 0;
+		size_t mipOffset = 0;
+		for (unsigned mip = 0; mip < MipCount; mip++)
+		{
+			if (mip == mipIndex) mipOffset = elementSize;
+			elementSize += align(Mips[mip].DataSize);
+		}
+		return elementSize * arrayIndex + mipOffset;
+	}
+
+	// Storage for every image is taken at once, from the pool if one is given.
+	inline bool generate_data(texture_pool *pool = nullptr)
 	{
 		// Cube maps must have a multiple of 6 images.
 		if (CubeMap && (ArrayCount % 6 != 0) || !Mips) return false;
 
 		// Calculate Array Properties
 		unsigned imageCount = ArrayCount * MipCount;
+		size_t tableSize = align(sizeof(unsigned char *) * imageCount);
+		size_t size = tableSize + get_offset(0, ArrayCount);
 
-		unsigned char **tempData;
-		try { tempData = new unsigned char *[imageCount]; }
-		catch (std::bad_alloc) { return false; }
-
-		for (unsigned i = 0; i < imageCount; i++) tempData[i] = nullptr;
+		unsigned char *storage = pool ? pool->acquire(size) : texture_pool::allocate(size);
+		if (!storage) return false;
 
-		bool error = false;
-		// Attempt to allocate memory for the image data.
+		unsigned char **tempData = (unsigned char **)storage;
 		for (unsigned element = 0; element < ArrayCount; element++)
 		{
 			for (unsigned mip = 0; mip < MipCount; mip++)
-			{
-				unsigned image = element * MipCount + mip;
-				unsigned size = Mips[mip].DataSize;
-				if (image >= imageCount)
-				{
-					int brk = 0;
-					continue;
-				}
-
-				tempData[image] = new(std::nothrow) unsigned char[size];
-				if (!tempData[image])
-				{
-					error = true;
-					break;
-				}
-			}
-			if (error) break;
-		}
-		
-		// Problem allocating memory.
-		if (error)
-		{
-			for (unsigned i = 0; i < imageCount; i++)
-			{
-				if (tempData[i]) delete[] tempData[i];
-				else break;
-			}
-			delete[] tempData;
-			return false;
+				tempData[element * MipCount + mip] = storage + tableSize + get_offset(mip, element);
 		}
 
 		// Everything worked out.
-		ImageCount = imageCount;
 		delete_data();
+		ImageCount = imageCount;
 		Data = tempData;
+		Storage = storage;
+		StorageSize = size;
+		Pool = pool;
 		return true;
 	}
 
 	inline void delete_data()
 	{
-		if (Data)
+		if (Storage)
 		{
-			for (unsigned i = 0; i < ImageCount; i++)
-				if (Data[i]) delete[] Data[i];
-
-			delete[] Data;
-			Data = nullptr;
+			if (Pool) Pool->release(Storage, StorageSize);
+			else texture_pool::deallocate(Storage);
 		}
+		Data = nullptr;
+		Storage = nullptr;
+		StorageSize = 0;
+		Pool = nullptr;
 	}
 
 	inline bool set_data(unsigned mipIndex, unsigned arrayIndex, unsigned dataSizeBytes, unsigned char *data)
@@ -132,6 +207,7 @@ struct texture_data
 		unsigned imageIndex = MipCount * arrayIndex + mipIndex;
 		if (!Data[imageIndex]) return false;
 		memcpy_s(Data[imageIndex], Mips[mipIndex].DataSize, data, dataSizeBytes);
+		return true;
 	}
 
 	inline unsigned char *get_data(unsigned mipIndex, unsigned arrayIndex)
@@ -1,5 +1,7 @@
 #include "ImageLoader.h"
 #include <fstream>
+#include "PNGFilters.h"
+#include "../thread_pool.h"
 #include "../zlib/zlib.h"
 
 using TChapman500::Graphics::texture_data;
@@ -10,7 +12,486 @@ using TChapman500::Graphics::texture_usage;
 namespace TChapman500 {
 namespace Graphics {
 
-ImageLoader::image ImageLoader::Load(std::wstring path)
+// How the pixels of a PNG are stored, and what is needed to turn them into RGBA.
+struct png_format
+{
+	unsigned char ColorType = 0;
+	unsigned char BitDepth = 0;
+	unsigned Channels = 0;
+
+	// From the tRNS chunk of a gray or RGB image: pixels of this color get an alpha of 0.
+	bool HasKey = false;
+	unsigned short Key[3] = {};
+
+	// RGBA colors of a palette image, in memory order.
+	unsigned Palette[256] = {};
+
+	inline bool Initialize(unsigned char colorType, unsigned char bitDepth)
+	{
+		switch (colorType)
+		{
+		case 0: Channels = 1; break;
+		case 2: Channels = 3; break;
+		case 3: Channels = 1; break;
+		case 4: Channels = 2; break;
+		case 6: Channels = 4; break;
+		default: return false;
+		}
+
+		// Gray may have any depth and palettes any up to 8.  Everything else is 8 or 16.
+		bool lowDepth = bitDepth == 1 || bitDepth == 2 || bitDepth == 4;
+		if (bitDepth != 8 && !(bitDepth == 16 && colorType != 3) && !(lowDepth && (colorType == 0 || colorType == 3))) return false;
+
+		ColorType = colorType;
+		BitDepth = bitDepth;
+
+		// Colors missing from the palette are opaque black.
+		unsigned char *entries = (unsigned char *)Palette;
+		for (unsigned i = 0; i < 256; i++) entries[i * 4 + 3] = 255;
+		return true;
+	}
+
+	// Bytes a scanline of this many pixels takes, not counting the filter byte.
+	inline size_t RowBytes(size_t width) const { return (width * Channels * BitDepth + 7) / 8; }
+
+	// Distance filters look back to, which is never less than a byte.
+	inline size_t FilterDistance() const { return Channels * BitDepth >= 8 ? Channels * BitDepth / 8 : 1; }
+
+	inline bool HasAlpha() const { return ColorType == 4 || ColorType == 6; }
+};
+
+// Value of one sample of a scanline, as stored.
+static inline unsigned ReadSample(const unsigned char *scanline, size_t index, unsigned bitDepth)
+{
+	if (bitDepth == 16) return ((unsigned)scanline[index * 2] << 8) | scanline[index * 2 + 1];
+	if (bitDepth == 8) return scanline[index];
+	size_t bit = index * bitDepth;
+	return (scanline[bit / 8] >> (8 - bitDepth - bit % 8)) & ((1 << bitDepth) - 1);
+}
+
+// Convert one unfiltered scanline into an RGBA row.  Samples that are not 8 bits are first
+// brought to 8 bits in the samples buffer, which holds at least four bytes per pixel.
+static void ConvertScanline(unsigned char *dest, const unsigned char *scanline, size_t width, const png_format &format, unsigned char *samples)
+{
+	// The usual case goes straight through.
+	if (format.BitDepth == 8)
+	{
+		if (format.ColorType == 6)
+		{
+			memcpy(dest, scanline, width * 4);
+			return;
+		}
+		if (format.ColorType == 2 && !format.HasKey)
+		{
+			ExpandRGB(dest, scanline, width);
+			return;
+		}
+	}
+
+	const unsigned char *source = scanline;
+	if (format.BitDepth == 16)
+	{
+		ScaleSamples16(samples, scanline, width * format.Channels);
+		source = samples;
+	}
+	else if (format.BitDepth < 8)
+	{
+		// Gray is scaled up to the full range, but palette indices are not.
+		UnpackSamples(samples, scanline, width, format.BitDepth, format.ColorType == 0);
+		source = samples;
+	}
+
+	switch (format.ColorType)
+	{
+	case 0: ExpandGray(dest, source, width); break;
+	case 2: ExpandRGB(dest, source, width); break;
+	case 3: ExpandPalette(dest, source, width, format.Palette); break;
+	case 4: ExpandGrayAlpha(dest, source, width); break;
+	case 6: memcpy(dest, source, width * 4); break;
+	}
+
+	// The key is compared against the samples as they were stored.
+	if (!format.HasKey) return;
+	for (size_t x = 0; x < width; x++)
+	{
+		bool match = true;
+		for (unsigned c = 0; c < format.Channels && match; c++)
+			match = ReadSample(scanline, x * format.Channels + c, format.BitDepth) == format.Key[c];
+		if (match) dest[x * 4 + 3] = 0;
+	}
+}
+
+// Where each of the seven passes of an Adam7 image starts, and how far apart its pixels are.
+static const unsigned Adam7StartX[7] = { 0, 4, 0, 2, 0, 1, 0 };
+static const unsigned Adam7StartY[7] = { 0, 0, 4, 0, 2, 0, 1 };
+static const unsigned Adam7StepX[7] = { 8, 8, 4, 4, 2, 2, 1 };
+static const unsigned Adam7StepY[7] = { 8, 8, 8, 4, 4, 2, 2 };
+
+// The scanlines of a PNG being decoded.  Inflated bytes go into Current, each with its filter
+// byte in front.  Once it is full it is unfiltered against Previous, which starts out as zeros,
+// and converted into the next row of the image.  Only these two scanlines are ever kept.  An
+// interlaced image is seven smaller images in a row, whose pixels are spread over the output.
+struct png_scanlines
+{
+	unsigned char *Buffer = nullptr;
+	unsigned char *Current = nullptr;
+	unsigned char *Previous = nullptr;
+	unsigned char *Samples = nullptr;
+	unsigned char *Pixels = nullptr;
+	size_t Length = 0;
+	size_t Filled = 0;
+	size_t BytesPerPixel = 0;
+	size_t TotalSize = 0;
+	const png_format *Format = nullptr;
+	unsigned char *Dest = nullptr;
+	unsigned Width = 0;
+	unsigned Height = 0;
+	bool Interlaced = false;
+	unsigned Pass = 0;
+	unsigned PassCount = 0;
+	unsigned PassWidth = 0;
+	unsigned PassHeight = 0;
+	unsigned Row = 0;
+
+	inline ~png_scanlines()
+	{
+		delete[] Buffer;
+		delete[] Samples;
+		delete[] Pixels;
+	}
+
+	inline bool Initialize(unsigned char *dest, unsigned width, unsigned height, const png_format &format, bool interlaced)
+	{
+		size_t maxLength = format.RowBytes(width) + 1;
+		Buffer = new(std::nothrow) unsigned char[maxLength * 2];
+		if (!Buffer) return false;
+		Current = Buffer;
+		Previous = Buffer + maxLength;
+		if (format.BitDepth != 8)
+		{
+			Samples = new(std::nothrow) unsigned char[(size_t)width * 4];
+			if (!Samples) return false;
+		}
+		if (interlaced)
+		{
+			Pixels = new(std::nothrow) unsigned char[(size_t)width * 4];
+			if (!Pixels) return false;
+		}
+
+		BytesPerPixel = format.FilterDistance();
+		Format = &format;
+		Dest = dest;
+		Width = width;
+		Height = height;
+		Interlaced = interlaced;
+		PassCount = interlaced ? 7 : 1;
+
+		for (unsigned pass = 0; pass < PassCount; pass++)
+		{
+			unsigned passWidth, passHeight;
+			_PassSize(pass, passWidth, passHeight);
+			if (passWidth && passHeight) TotalSize += (format.RowBytes(passWidth) + 1) * passHeight;
+		}
+		_StartPass(0);
+		return true;
+	}
+
+	inline bool Done() { return Pass == PassCount; }
+
+	inline void Finish()
+	{
+		UnfilterScanline(Current[0], Current + 1, Previous + 1, Length - 1, BytesPerPixel);
+		if (!Interlaced) ConvertScanline(Dest + (size_t)Row * Width * 4, Current + 1, Width, *Format, Samples);
+		else
+		{
+			ConvertScanline(Pixels, Current + 1, PassWidth, *Format, Samples);
+			unsigned char *row = Dest + ((size_t)Adam7StartY[Pass] + (size_t)Row * Adam7StepY[Pass]) * Width * 4;
+			for (unsigned x = 0; x < PassWidth; x++)
+				memcpy(row + ((size_t)Adam7StartX[Pass] + (size_t)x * Adam7StepX[Pass]) * 4, Pixels + (size_t)x * 4, 4);
+		}
+		std::swap(Current, Previous);
+		Filled = 0;
+		Row++;
+		if (Row == PassHeight) _StartPass(Pass + 1);
+	}
+
+	// Data after the last row is ignored.
+	inline void Feed(const unsigned char *data, size_t size)
+	{
+		while (size && !Done())
+		{
+			size_t copy = Length - Filled < size ? Length - Filled : size;
+			memcpy(Current + Filled, data, copy);
+			Filled += copy;
+			data += copy;
+			size -= copy;
+			if (Filled == Length) Finish();
+		}
+	}
+
+	inline void _PassSize(unsigned pass, unsigned &passWidth, unsigned &passHeight)
+	{
+		if (!Interlaced)
+		{
+			passWidth = Width;
+			passHeight = Height;
+			return;
+		}
+		passWidth = Width > Adam7StartX[pass] ? (Width - Adam7StartX[pass] + Adam7StepX[pass] - 1) / Adam7StepX[pass] : 0;
+		passHeight = Height > Adam7StartY[pass] ? (Height - Adam7StartY[pass] + Adam7StepY[pass] - 1) / Adam7StepY[pass] : 0;
+	}
+
+	// Passes with no pixels have no scanlines at all.  Each pass starts over from a zero row.
+	inline void _StartPass(unsigned pass)
+	{
+		for (Pass = pass; Pass < PassCount; Pass++)
+		{
+			_PassSize(Pass, PassWidth, PassHeight);
+			if (PassWidth && PassHeight) break;
+		}
+		Row = 0;
+		if (Done()) return;
+		Length = Format->RowBytes(PassWidth) + 1;
+		memset(Previous, 0, Length);
+	}
+};
+
+// Offsets just past each empty stored block (00 00 FF FF), which an encoder writes at a flush.
+// Only points at least minSpacing apart are kept.  Some of them may be chance byte patterns or
+// flushes that still refer back to earlier data; InflateSegment() finds those.
+static std::vector<size_t> FindRestartPoints(const unsigned char *data, size_t size, size_t minSpacing)
+{
+	std::vector<size_t> points;
+	size_t last = 0;
+	for (size_t i = 2; i + 4 <= size; i++)
+	{
+		if (data[i] != 0 || data[i + 1] != 0 || data[i + 2] != 0xFF || data[i + 3] != 0xFF) continue;
+		if (i + 4 - last < minSpacing || size - (i + 4) < minSpacing) continue;
+		last = i + 4;
+		points.push_back(last);
+	}
+	return points;
+}
+
+// Inflated data of one piece of a zlib stream.  The buffer is not cleared first, since all of
+// it is about to be written.
+struct inflated_segment
+{
+	std::unique_ptr<unsigned char[]> Data;
+	size_t Size = 0;
+	size_t Capacity = 0;
+
+	inline bool Reserve(size_t capacity)
+	{
+		unsigned char *data = new(std::nothrow) unsigned char[capacity];
+		if (!data) return false;
+		if (Size) memcpy(data, Data.get(), Size);
+		Data.reset(data);
+		Capacity = capacity;
+		return true;
+	}
+};
+
+// Inflate one piece of a zlib stream on its own.  Every piece but the first is raw deflate
+// data with no history, so a piece that refers back past its start fails.  Every piece but the
+// last must end exactly on a block boundary, which is only true if its end really was a flush.
+static bool InflateSegment(const unsigned char *data, size_t size, bool first, bool last, size_t expectedSize, size_t outputLimit, inflated_segment &output)
+{
+	z_stream zs;
+	memset(&zs, 0, sizeof(z_stream));
+	if ((first ? inflateInit(&zs) : inflateInit2(&zs, -15)) != Z_OK) return false;
+
+	if (!output.Reserve(expectedSize < outputLimit ? expectedSize : outputLimit))
+	{
+		inflateEnd(&zs);
+		return false;
+	}
+	zs.next_in = (Bytef *)data;
+	zs.avail_in = (uInt)size;
+	zs.next_out = (Bytef *)output.Data.get();
+	zs.avail_out = (uInt)output.Capacity;
+
+	bool result = false;
+	while (true)
+	{
+		int ret = inflate(&zs, last ? Z_NO_FLUSH : Z_BLOCK);
+		output.Size = output.Capacity - zs.avail_out;
+		if (ret == Z_STREAM_END)
+		{
+			result = last;
+			break;
+		}
+		if (ret != Z_OK && ret != Z_BUF_ERROR) break;
+
+		if (zs.avail_out == 0)
+		{
+			// More than the whole image.
+			if (output.Capacity == outputLimit) break;
+
+			size_t capacity = output.Capacity * 2 < outputLimit ? output.Capacity * 2 : outputLimit;
+			if (!output.Reserve(capacity)) break;
+			zs.next_out = (Bytef *)output.Data.get() + output.Size;
+			zs.avail_out = (uInt)(output.Capacity - output.Size);
+			continue;
+		}
+		if (zs.avail_in == 0)
+		{
+			result = !last && (zs.data_type & 128) && !(zs.data_type & 64) && (zs.data_type & 7) == 0;
+			break;
+		}
+		if (ret == Z_BUF_ERROR) break;
+	}
+
+	inflateEnd(&zs);
+	return result;
+}
+
+// Inflate on the calling thread while another thread unfilters and converts what is ready.
+// Blocks pass between them through a small queue, so memory stays bounded.
+static bool InflatePipelined(const unsigned char *data, size_t size, png_scanlines &rows, bool threaded)
+{
+	const size_t blockSize = 256 * 1024;
+	const size_t blockCount = 4;
+
+	z_stream zs;
+	memset(&zs, 0, sizeof(z_stream));
+	if (inflateInit(&zs) != Z_OK) return false;
+	zs.next_in = (Bytef *)data;
+	zs.avail_in = (uInt)size;
+
+	std::mutex mutex;
+	std::condition_variable condition;
+	std::deque<std::vector<unsigned char>> full;
+	std::vector<std::vector<unsigned char>> empty(blockCount);
+	bool finished = false;
+
+	std::thread converter;
+	if (threaded)
+	{
+		converter = std::thread([&]() {
+			while (true)
+			{
+				std::vector<unsigned char> block;
+				{
+					std::unique_lock<std::mutex> lock(mutex);
+					condition.wait(lock, [&]() { return finished || !full.empty(); });
+					if (full.empty()) return;
+					block = std::move(full.front());
+					full.pop_front();
+				}
+				rows.Feed(block.data(), block.size());
+				{
+					std::lock_guard<std::mutex> lock(mutex);
+					empty.push_back(std::move(block));
+				}
+				condition.notify_all();
+			}
+		});
+	}
+
+	bool result = false;
+	while (true)
+	{
+		std::vector<unsigned char> block;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			condition.wait(lock, [&]() { return !empty.empty(); });
+			block = std::move(empty.back());
+			empty.pop_back();
+		}
+
+		block.resize(blockSize);
+		zs.next_out = (Bytef *)block.data();
+		zs.avail_out = (uInt)blockSize;
+		int ret = inflate(&zs, Z_NO_FLUSH);
+		block.resize(blockSize - zs.avail_out);
+
+		if (threaded)
+		{
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				full.push_back(std::move(block));
+			}
+			condition.notify_all();
+		}
+		else
+		{
+			rows.Feed(block.data(), block.size());
+			empty.push_back(std::move(block));
+		}
+
+		if (ret == Z_STREAM_END)
+		{
+			result = true;
+			break;
+		}
+		if (ret != Z_OK && ret != Z_BUF_ERROR) break;
+		if (zs.avail_out != 0 && zs.avail_in == 0) break;
+	}
+
+	if (threaded)
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			finished = true;
+		}
+		condition.notify_all();
+		converter.join();
+	}
+	inflateEnd(&zs);
+	return result || rows.Done();
+}
+
+// Decode on several threads.  If the encoder left full flush points in the stream, the pieces
+// between them are inflated at the same time.  Otherwise inflating and unfiltering overlap.
+static bool InflateParallel(const std::vector<unsigned char> &compressed, png_scanlines &rows)
+{
+	size_t imageSize = rows.TotalSize;
+
+	// Small images are not worth the threads.
+	if (imageSize < 1024 * 1024) return InflatePipelined(compressed.data(), compressed.size(), rows, false);
+
+	thread_pool &pool = thread_pool::shared();
+	size_t spacing = compressed.size() / ((size_t)pool.size() * 4);
+	if (spacing < 256 * 1024) spacing = 256 * 1024;
+	std::vector<size_t> points = FindRestartPoints(compressed.data(), compressed.size(), spacing);
+
+	if (!points.empty())
+	{
+		points.insert(points.begin(), 0);
+		points.push_back(compressed.size());
+
+		size_t segmentCount = points.size() - 1;
+		std::vector<inflated_segment> outputs(segmentCount);
+		std::vector<char> valid(segmentCount, 0);
+		pool.parallel_for(segmentCount, 1, [&](size_t begin, size_t end) {
+			for (size_t i = begin; i < end; i++)
+			{
+				// Guess each piece's share of the image from its share of the data.
+				size_t size = points[i + 1] - points[i];
+				size_t expectedSize = (size_t)((double)imageSize * size / compressed.size() * 1.25) + 64 * 1024;
+				valid[i] = InflateSegment(compressed.data() + points[i], size, i == 0, i + 1 == segmentCount, expectedSize, imageSize + 1, outputs[i]);
+			}
+		});
+
+		bool allValid = true;
+		size_t total = 0;
+		for (size_t i = 0; i < segmentCount; i++)
+		{
+			allValid = allValid && valid[i];
+			total += outputs[i].Size;
+		}
+		if (allValid && total >= imageSize)
+		{
+			for (const inflated_segment &output : outputs) rows.Feed(output.Data.get(), output.Size);
+			return rows.Done();
+		}
+	}
+
+	return InflatePipelined(compressed.data(), compressed.size(), rows, true);
+}
+
+ImageLoader::image ImageLoader::Load(std::wstring path, bool parallel, texture_pool *pool)
 {
 	// Empty Result to be returned on error.
 	image result;
@@ -25,11 +506,11 @@ ImageLoader::image ImageLoader::Load(std::wstring path)
 		extension[i] = towlower(extension[i]);
 
 	// Load TGA file.
-	if (extension == L"tga") return LoadTGA(path);
+	if (extension == L"tga") return LoadTGA(path, pool);
 	// Load BMP file.
 	//if (extension == L"bmp") return LoadBMP(path);
 	// Load PNG file.
-	if (extension == L"png") return LoadPNG(path);
+	if (extension == L"png") return LoadPNG(path, parallel, pool);
 	// Load DDS file.
 	//if (extension == L"dds") return LoadDDS(path);
 
@@ -37,18 +518,18 @@ ImageLoader::image ImageLoader::Load(std::wstring path)
 	return result;
 }
 
-ImageLoader::image ImageLoader::LoadTGA(std::wstring path)
+ImageLoader::image ImageLoader::LoadTGA(std::wstring path, texture_pool *pool)
 {
 	image result;
 	memset(&result, 0, sizeof(image));
 	std::fstream file(path, std::ios::in | std::ios::binary);
 	if (!file.is_open()) return result;
-	result = LoadTGA(file);
+	result = LoadTGA(file, pool);
 	file.close();
 	return result;
 }
 
-ImageLoader::image ImageLoader::LoadTGA(std::iostream &file)
+ImageLoader::image ImageLoader::LoadTGA(std::iostream &file, texture_pool *pool)
 {
 	image result;
 	memset(&result, 0, sizeof(image));
@@ -105,7 +586,7 @@ ImageLoader::image ImageLoader::LoadTGA(std::iostream &file)
 	result.Textures[0].Mips[0].Height = height;
 	result.Textures[0].Mips[0].BytesPerRow = 4 * width;
 	result.Textures[0].Mips[0].DataSize = 4 * width * height;
-	if (!result.Textures[0].generate_data())
+	if (!result.Textures[0].generate_data(pool))
 	{
 		delete[] result.Textures;
 		result.Textures = nullptr;
@@ -167,18 +648,18 @@ ImageLoader::image ImageLoader::LoadTGA(std::iostream &file)
 	return result;
 }
 
-ImageLoader::image ImageLoader::LoadPNG(std::wstring path)
+ImageLoader::image ImageLoader::LoadPNG(std::wstring path, bool parallel, texture_pool *pool)
 {
 	image result;
 	memset(&result, 0, sizeof(image));
 	std::fstream file(path, std::ios::in | std::ios::binary);
 	if (!file.is_open()) return result;
-	result = LoadPNG(file);
+	result = LoadPNG(file, parallel, pool);
 	file.close();
 	return result;
 }
 
-ImageLoader::image ImageLoader::LoadPNG(std::iostream &file)
+ImageLoader::image ImageLoader::LoadPNG(std::iostream &file, bool parallel, texture_pool *pool)
 {
 	image result;
 	memset(&result, 0, sizeof(image));
@@ -205,34 +686,32 @@ ImageLoader::image ImageLoader::LoadPNG(std::iostream &file)
 		unsigned char BitDepth;
 		unsigned char ColorType;
 		unsigned short Zero;
-		bool Interlace;
+		unsigned char Interlace;
 	};
 	chunk_IHDR ihdr;
 	ZeroMemory(&ihdr, sizeof(chunk_IHDR));
 
-	struct chunk_IDAT
-	{
-		unsigned char *Buffer;
-		size_t ChunkSize;
-	};
-	chunk_IDAT idat;
-	idat.Buffer = nullptr;
+	// IDAT data is read in pieces of this size and fed straight to zlib.  The parallel decoder
+	// needs all of it at once instead.
+	const size_t inputSize = 64 * 1024;
+	unsigned char *input = nullptr;
+	std::vector<unsigned char> compressed;
 
-	size_t bufferSize = 0;
-	size_t bufferRead = 0;
-	unsigned char *readBuffer = nullptr;
-	unsigned char *readPos = nullptr;
+	png_format format;
+	bool hasPalette = false;
+	png_scanlines rows;
+	bool streamEnd = false;
 
 	z_stream zs;
 	memset(&zs, 0, sizeof(z_stream));
-	if (inflateInit(&zs) != Z_OK)
-	{
+	if (inflateInit(&zs) != Z_OK) return result;
+
+	auto fail = [&]() -> image {
+		inflateEnd(&zs);
+		delete[] input;
 		DestroyImage(result);
-		delete[] idat.Buffer;
 		return result;
-	}
-
-	std::vector<chunk_IDAT> chunks;
+	};
 
 	while (true)
 	{
@@ -240,6 +719,7 @@ ImageLoader::image ImageLoader::LoadPNG(std::iostream &file)
 		chunkHeader.Length = chunk::ConvertInt(chunkHeader.Length);
 
 		file.read((char *)&chunkHeader.Type, 4);
+		if (!file) return fail();
 		if (chunkHeader.Type == 0x444E4549)		// IEND
 		{
 			file.seekg(file.tellg() + (std::streampos)4);
@@ -247,6 +727,8 @@ ImageLoader::image ImageLoader::LoadPNG(std::iostream &file)
 		}
 		if (chunkHeader.Type == 0x52444849)		// IHDR
 		{
+			if (result.Textures) return fail();
+
 			file.read((char *)&ihdr.Width, 4);
 			ihdr.Width = chunk::ConvertInt(ihdr.Width);
 
@@ -254,15 +736,14 @@ ImageLoader::image ImageLoader::LoadPNG(std::iostream &file)
 			ihdr.Height = chunk::ConvertInt(ihdr.Height);
 
 			file.read((char *)&ihdr.BitDepth, 1);
-			if (ihdr.BitDepth != 8) return result;
 			file.read((char *)&ihdr.ColorType, 1);
-			if (ihdr.ColorType != 2 && ihdr.ColorType != 6) return result;
+			if (!format.Initialize(ihdr.ColorType, ihdr.BitDepth)) return fail();
 			file.read((char *)&ihdr.Zero, 2);
-			if (ihdr.Zero != 0) return result;
+			if (ihdr.Zero != 0) return fail();
 
-			// We're not going to support this.
 			file.read((char *)&ihdr.Interlace, 1);
-			if (ihdr.Interlace) return result;
+			if (ihdr.Interlace > 1) return fail();
+			if (!ihdr.Width || !ihdr.Height) return fail();
 
 			// Skip CRC
 			file.seekg(file.tellg() + (std::streampos)4);
@@ -271,174 +752,243 @@ ImageLoader::image ImageLoader::LoadPNG(std::iostream &file)
 			result.Height = ihdr.Height;
 			result.Format = texture_format::RGBA_8888;
 			result.Textures = new texture_data[1];
-			result.Textures[0].ArrayCount = 1;
+			result.Textures[0].initialize(1, 1);
 			result.Textures[0].CubeMap = false;
 			result.Textures[0].Format = texture_format::RGBA_8888;
 			result.Textures[0].Width = result.Width;
 			result.Textures[0].Height = result.Height;
-			result.Textures[0].ImageCount = 1;
-			result.Textures[0].MipCount = 1;
-			result.Textures[0].ArrayCount = 1;
-			result.Textures[0].Transparent = ihdr.ColorType == 6;
-			result.Textures[0].Mips = new mip_data[1];
+			result.Textures[0].Transparent = format.HasAlpha();
 			result.Textures[0].Mips[0].Width = result.Width;
 			result.Textures[0].Mips[0].Height = result.Height;
 			result.Textures[0].Mips[0].BytesPerRow = result.Width * 4;
 			result.Textures[0].Mips[0].DataSize = result.Textures[0].Mips[0].BytesPerRow * result.Height;
-			result.Textures[0].Data = new unsigned char *[1];
-			result.Textures[0].Data[0] = new unsigned char[result.Textures[0].Mips[0].DataSize];
+			if (!result.Textures[0].generate_data(pool)) return fail();
+			if (!rows.Initialize(result.Textures[0].get_data(0, 0), result.Width, result.Height, format, ihdr.Interlace == 1)) return fail();
 
-			if (ihdr.ColorType == 2) bufferSize = ((size_t)result.Width * 3 + 1) * (size_t)result.Height;
-			else bufferSize = ((size_t)result.Width * 4 + 1) * (size_t)result.Height;
-			readBuffer = new unsigned char[bufferSize];
-			readPos = readBuffer;
+			input = new(std::nothrow) unsigned char[inputSize];
+			if (!input) return fail();
+			zs.next_out = (Bytef *)rows.Current;
+			zs.avail_out = (uInt)rows.Length;
 		}
-		else if (chunkHeader.Type == 0x54414449)	// IDAT
+		else if (chunkHeader.Type == 0x45544C50)	// PLTE
 		{
-			idat.Buffer = new unsigned char[chunkHeader.Length];
-			idat.ChunkSize = chunkHeader.Length;
-			// Read the chunk data
-			file.read((char*)idat.Buffer, chunkHeader.Length);
+			if (!rows.Buffer || chunkHeader.Length % 3 || chunkHeader.Length > 768) return fail();
+
+			unsigned char colors[768];
+			file.read((char *)colors, chunkHeader.Length);
+			if (!file) return fail();
+			unsigned char *entries = (unsigned char *)format.Palette;
+			for (unsigned i = 0; i < chunkHeader.Length / 3; i++) memcpy(entries + i * 4, colors + i * 3, 3);
+			hasPalette = true;
 			file.seekg(file.tellg() + (std::streampos)4);
-			chunks.push_back(idat);
 		}
-		else file.seekg(file.tellg() + (std::streampos)chunkHeader.Length + (std::streampos)4);
-	}
-
-	size_t totalSize = 0;
-	for (const chunk_IDAT &chunk : chunks) totalSize += chunk.ChunkSize;
-	unsigned char *fullBuffer = new unsigned char[totalSize];
-	unsigned char *currPos = fullBuffer;
-	for (const chunk_IDAT &chunk : chunks)
-	{
-		memcpy_s(currPos, chunk.ChunkSize, chunk.Buffer, chunk.ChunkSize);
-		currPos += chunk.ChunkSize;
-		delete[] chunk.Buffer;
-	}
-
-	//*
-	zs.next_in = (Bytef *)fullBuffer;
-	zs.avail_in = (uInt)totalSize;
-	zs.next_out = (Bytef *)readPos;
-	zs.avail_out = (uInt)bufferSize;
-
-	int ret = inflate(&zs, Z_NO_FLUSH);
-	if (ret != Z_STREAM_END && ret != Z_OK)
-	{
-		inflateEnd(&zs);
-		DestroyImage(result);
-		delete[] fullBuffer;
-		return result;
-	}
-
-	//*/
-
-
-
-	inflateEnd(&zs);
-
-	// Clean-up!
-	if (fullBuffer) delete[] fullBuffer;
-
-	auto paethPredictor = [](unsigned char a, unsigned char b, unsigned char c) -> unsigned char {
-
-		short p = (short)a + (short)b - (short)c;
-		short pa = abs(p - (short)a);
-		short pb = abs(p - (short)b);
-		short pc = abs(p - (short)c);
-		if (pa <= pb && pa <= pc) return a;
-		if (pb <= pc) return b;
-		return c;
-	};
-	auto runScanline = [paethPredictor](unsigned char *scanline, size_t scanlineLength, size_t bytesPerPixel, size_t scanlineIndex) -> void {
-		unsigned char filter = *scanline;
-		switch (filter)
+		else if (chunkHeader.Type == 0x534E5274)	// tRNS
 		{
-		case 0:		// No Filter
-			break;
-		case 1:		// Sub
-			for (size_t x = 1; x < scanlineLength; x++)
+			if (!rows.Buffer || chunkHeader.Length > 256) return fail();
+
+			unsigned char values[256];
+			file.read((char *)values, chunkHeader.Length);
+			if (!file) return fail();
+			if (format.ColorType == 3)
 			{
-				if (x >= bytesPerPixel + 1) scanline[x] += scanline[x - bytesPerPixel];
+				// Alpha of each palette entry, in order.  Entries past the end stay opaque.
+				unsigned char *entries = (unsigned char *)format.Palette;
+				for (unsigned i = 0; i < chunkHeader.Length; i++) entries[i * 4 + 3] = values[i];
+				result.Textures[0].Transparent = true;
 			}
-			break;
-		case 2:		// Up
-			for (size_t x = 1; x < scanlineLength; x++)
+			else if ((format.ColorType == 0 || format.ColorType == 2) && chunkHeader.Length == format.Channels * 2)
 			{
-				if (scanlineIndex > 0)
-					scanline[x] += scanlineIndex > 0 ? scanline[x - scanlineLength] : 0;
+				for (unsigned c = 0; c < format.Channels; c++)
+					format.Key[c] = (unsigned short)((values[c * 2] << 8) | values[c * 2 + 1]);
+				format.HasKey = true;
+				result.Textures[0].Transparent = true;
 			}
-			break;
-		case 3:		// Average
-			for (size_t x = 1; x < scanlineLength; x++)
-			{
-				unsigned char a = 0;
-				unsigned char b = scanlineIndex > 0 ? scanline[x - scanlineLength] : 0;
-
-				if (x >= bytesPerPixel + 1) a = scanline[x - bytesPerPixel];
+			file.seekg(file.tellg() + (std::streampos)4);
+		}
+		else if (chunkHeader.Type == 0x54414449)	// IDAT
+		{
+			if (!rows.Buffer) return fail();
+			if (format.ColorType == 3 && !hasPalette) return fail();
 
-				scanline[x] += (a + b) >> 1;
+			if (parallel)
+			{
+				size_t used = compressed.size();
+				compressed.resize(used + chunkHeader.Length);
+				file.read((char *)compressed.data() + used, chunkHeader.Length);
+				if (!file) return fail();
+				file.seekg(file.tellg() + (std::streampos)4);
+				continue;
 			}
-			break;
-		case 4:		// Paeth
-			for (size_t x = 1; x < scanlineLength; x++)
+
+			// Inflate each piece as soon as it is read, finishing rows as they fill up.
+			for (size_t remaining = chunkHeader.Length; remaining > 0; )
 			{
-				unsigned char a = 0;
-				unsigned char b = 0;
-				unsigned char c = 0;
+				size_t readSize = remaining < inputSize ? remaining : inputSize;
+				file.read((char *)input, (std::streamsize)readSize);
+				if (!file) return fail();
+				remaining -= readSize;
 
-				if (x >= bytesPerPixel + 1)
+				// Data after the last row is ignored.
+				if (streamEnd || rows.Done()) continue;
+
+				zs.next_in = (Bytef *)input;
+				zs.avail_in = (uInt)readSize;
+				while (!rows.Done())
 				{
-					a = scanline[x - bytesPerPixel];
-					if (scanlineIndex > 0)
+					int ret = inflate(&zs, Z_NO_FLUSH);
+					if (ret != Z_OK && ret != Z_STREAM_END && ret != Z_BUF_ERROR) return fail();
+					if (zs.avail_out == 0)
 					{
-						b = scanline[x - scanlineLength];
-						c = scanline[x - (scanlineLength + bytesPerPixel)];
+						rows.Finish();
+						zs.next_out = (Bytef *)rows.Current;
+						zs.avail_out = (uInt)rows.Length;
+						continue;
 					}
+					if (ret == Z_STREAM_END) streamEnd = true;
+					if (streamEnd || zs.avail_in == 0) break;
 				}
-				else if (scanlineIndex > 0) b = scanline[x - scanlineLength + bytesPerPixel];
-				scanline[x] += paethPredictor(a, b, c);
 			}
-			break;
+			file.seekg(file.tellg() + (std::streampos)4);
 		}
+		else file.seekg(file.tellg() + (std::streampos)chunkHeader.Length + (std::streampos)4);
+	}
+
+	if (parallel && rows.Buffer && !InflateParallel(compressed, rows)) return fail();
+
+	// The image data ended early.
+	if (!rows.Buffer || !rows.Done()) return fail();
+
+	// Clean-up!
+	inflateEnd(&zs);
+	delete[] input;
+	return result;
+}
+
+struct ImageLoader::batch::state
+{
+	enum item_state : unsigned char
+	{
+		Queued,
+		Loading,
+		Ready,
+		Taken
 	};
 
-	size_t bytesPerPixel = ihdr.ColorType == 6 ? 4 : 3;
-	size_t scanlineLength = result.Width * bytesPerPixel + 1;
-	unsigned char *dest = result.Textures[0].Data[0];
+	std::vector<std::wstring> Paths;
+	std::vector<image> Images;
+	std::vector<std::exception_ptr> Errors;
+	std::vector<unsigned char> States;
+	texture_pool *Pool = nullptr;
+
+	// Images the pool is loading or has loaded that have not been taken yet.
+	size_t InFlight = 0;
+	size_t Limit = 0;
+
+	// No path before this one is still queued.
+	size_t Next = 0;
+	bool Abandoned = false;
 
-	for (unsigned y = 0; y < result.Height; y++)
+	std::mutex Mutex;
+	std::condition_variable Condition;
+
+	// Queue loads on the pool until the limit is reached.  The mutex must be held.
+	static void Start(const std::shared_ptr<state> &batchState)
 	{
-		size_t scanlineIndex = y;
-		unsigned char *scanline = readBuffer + (y * scanlineLength);
-		runScanline(scanline, scanlineLength, bytesPerPixel, scanlineIndex);
-		if (ihdr.ColorType == 6)
-		{
-			for (unsigned x = 0; x < result.Width; x++)
-			{
-				unsigned iByte = (y * (result.Width * 4 + 1) + x * 4) + 1;
-				unsigned oByte = y * result.Width * 4 + x * 4;
-				dest[oByte + 0] = readBuffer[iByte + 0];
-				dest[oByte + 1] = readBuffer[iByte + 1];
-				dest[oByte + 2] = readBuffer[iByte + 2];
-				dest[oByte + 3] = readBuffer[iByte + 3];
-			}
-		}
-		else
+		state &self = *batchState;
+		while (self.InFlight < self.Limit)
 		{
-			for (unsigned x = 0; x < result.Width; x++)
-			{
-				unsigned iByte = (y * (result.Width * 3 + 1) + x * 3) + 1;
-				unsigned oByte = y * result.Width * 4 + x * 4;
-				dest[oByte + 0] = readBuffer[iByte + 0];
-				dest[oByte + 1] = readBuffer[iByte + 1];
-				dest[oByte + 2] = readBuffer[iByte + 2];
-				dest[oByte + 3] = 255;
-			}
+			while (self.Next < self.Paths.size() && self.States[self.Next] != Queued) self.Next++;
+			if (self.Next == self.Paths.size()) break;
+
+			size_t index = self.Next++;
+			self.States[index] = Loading;
+			self.InFlight++;
+			thread_pool::shared().run([batchState, index]() {
+				image result = {};
+				std::exception_ptr error;
+				try { result = Load(batchState->Paths[index], false, batchState->Pool); }
+				catch (...) { error = std::current_exception(); }
+
+				std::lock_guard<std::mutex> lock(batchState->Mutex);
+				if (batchState->Abandoned)
+				{
+					DestroyImage(result);
+					return;
+				}
+				batchState->Images[index] = result;
+				batchState->Errors[index] = error;
+				batchState->States[index] = Ready;
+				batchState->Condition.notify_all();
+			});
 		}
 	}
-	delete[] readBuffer;
+};
+
+ImageLoader::batch::~batch()
+{
+	if (!State) return;
+	std::lock_guard<std::mutex> lock(State->Mutex);
+	State->Abandoned = true;
+	for (size_t i = 0; i < State->Paths.size(); i++)
+	{
+		if (State->States[i] != state::Ready) continue;
+		DestroyImage(State->Images[i]);
+		State->States[i] = state::Taken;
+	}
+}
+
+size_t ImageLoader::batch::size() const
+{
+	return State ? State->Paths.size() : 0;
+}
+
+ImageLoader::image ImageLoader::batch::take(size_t index)
+{
+	image result = {};
+	if (index >= size()) return result;
+
+	std::unique_lock<std::mutex> lock(State->Mutex);
+	if (State->States[index] == state::Taken) return result;
+
+	// Nothing has started on this image, and the pool may be full of images the caller has not
+	// taken yet, so waiting for a slot could wait forever.
+	if (State->States[index] == state::Queued)
+	{
+		State->States[index] = state::Taken;
+		lock.unlock();
+		return Load(State->Paths[index], false, State->Pool);
+	}
 
+	State->Condition.wait(lock, [&]() { return State->States[index] == state::Ready; });
+	result = State->Images[index];
+	std::exception_ptr error = State->Errors[index];
+	State->Images[index] = {};
+	State->Errors[index] = nullptr;
+	State->States[index] = state::Taken;
+	State->InFlight--;
+	state::Start(State);
+	lock.unlock();
+
+	if (error) std::rethrow_exception(error);
+	return result;
+}
+
+ImageLoader::batch ImageLoader::LoadBatch(const std::vector<std::wstring> &paths, unsigned maxInFlight, texture_pool *pool)
+{
+	batch result;
+	result.State = std::make_shared<batch::state>();
+	batch::state &self = *result.State;
+	self.Paths = paths;
+	self.Images.resize(paths.size());
+	self.Errors.resize(paths.size());
+	self.States.resize(paths.size(), batch::state::Queued);
+	self.Pool = pool;
+	self.Limit = maxInFlight ? maxInFlight : thread_pool::shared().size();
+
+	// Each load is queued as its own task once there is room for it, so no pool thread ever
+	// waits on the caller or on another load.
+	std::lock_guard<std::mutex> lock(self.Mutex);
+	batch::state::Start(result.State);
 	return result;
 }
 
@@ -463,4 +1013,17 @@ std::shared_ptr<Texture> CreateTexture(std::wstring path)
 	return result;
 }
 
+std::vector<std::shared_ptr<Texture>> CreateTextures(const std::vector<std::wstring> &paths)
+{
+	ImageLoader::batch images = ImageLoader::LoadBatch(paths);
+	std::vector<std::shared_ptr<Texture>> result(paths.size());
+	for (size_t i = 0; i < images.size(); i++)
+	{
+		ImageLoader::image image = images.take(i);
+		if (image.Width != 0 && image.Height != 0) result[i] = std::make_shared<Texture>(image.Textures[0]);
+		ImageLoader::DestroyImage(image);
+	}
+	return result;
+}
+
 }}
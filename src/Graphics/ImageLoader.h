@@ -1,5 +1,7 @@
 #pragma once
 #include <string>
+#include <vector>
+#include <memory>
 #include "Textures.h"
 
 namespace TChapman500 {
@@ -16,14 +18,47 @@ public:
 		TChapman500::Graphics::texture_data *Textures;
 	};
 
-	static image Load(std::wstring path);
+	// With parallel set, large images are decoded on several threads.  With a pool, storage
+	// for the image is taken from it and goes back to it when the image is destroyed.
+	static image Load(std::wstring path, bool parallel = false, texture_pool *pool = nullptr);
 
-	static image LoadTGA(std::wstring path);
-	static image LoadTGA(std::iostream &file);
+	static image LoadTGA(std::wstring path, texture_pool *pool = nullptr);
+	static image LoadTGA(std::iostream &file, texture_pool *pool = nullptr);
 
-	static image LoadPNG(std::wstring path);
-	static image LoadPNG(std::iostream &file);
+	static image LoadPNG(std::wstring path, bool parallel = false, texture_pool *pool = nullptr);
+	static image LoadPNG(std::iostream &file, bool parallel = false, texture_pool *pool = nullptr);
 
+	// Images being loaded by LoadBatch().  Images are loaded in the order of their paths, and no
+	// more than the batch's limit are loading or waiting to be taken at once.  Taking one lets
+	// the next start.  Images that are never taken are destroyed with the batch.
+	class batch
+	{
+	public:
+		batch() = default;
+		~batch();
+
+		batch(const batch &) = delete;
+		batch &operator=(const batch &) = delete;
+		batch(batch &&) = default;
+		batch &operator=(batch &&) = default;
+
+		size_t size() const;
+
+		// Wait for an image and hand it to the caller, who must pass it to DestroyImage().  An
+		// image that has not started yet is loaded on the calling thread.  Each image can only be
+		// taken once; after that this returns an empty image.
+		image take(size_t index);
+
+	private:
+		friend class ImageLoader;
+		struct state;
+		std::shared_ptr<state> State;
+	};
+
+	// Load many images on the shared thread pool.  At most maxInFlight images are loading or
+	// loaded but not yet taken from the batch, which bounds memory use; 0 means one per pool
+	// thread.  While some threads wait on reads, others decode.
+	static batch LoadBatch(const std::vector<std::wstring> &paths, unsigned maxInFlight = 0, texture_pool *pool = nullptr);
 
 	static void DestroyImage(image &image);
 };
@@ -31,5 +66,9 @@ public:
 std::shared_ptr<ShaderResourceView> CreateShaderResource(std::wstring path);
 std::shared_ptr<Texture> CreateTexture(std::wstring path);
 
+// Same as CreateTexture() for each path, with the images loaded by LoadBatch().  Textures are
+// created on the calling thread as images are taken from the batch, in order.  Any that fail to load are nullptr.
+std::vector<std::shared_ptr<Texture>> CreateTextures(const std::vector<std::wstring> &paths);
+
 }}
 
@@ -0,0 +1,351 @@
+#include "Mipmaps.h"
+#include <math.h>
+#include <string.h>
+#include <vector>
+#include "../thread_pool.h"
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define TC500_MIP_SSE2
+#include <immintrin.h>
+#endif
+
+namespace TChapman500 {
+namespace Graphics {
+
+// Conversions between stored 8-bit values and the values that are filtered.  Going back uses a
+// coarse table for a first guess, then the exact halfway points between 8-bit values.
+struct color_tables
+{
+	float ToLinear[256];
+	float Threshold[257];
+	unsigned char Guess[4097];
+
+	inline color_tables(bool srgb)
+	{
+		for (unsigned v = 0; v < 256; v++) ToLinear[v] = Decode(v / 255.0, srgb);
+		Threshold[0] = -1.0f;
+		Threshold[256] = 2.0f;
+		for (unsigned v = 1; v < 256; v++) Threshold[v] = Decode((v - 0.5) / 255.0, srgb);
+		for (unsigned i = 0; i <= 4096; i++)
+		{
+			double value = i / 4096.0;
+			double stored = srgb ? (value <= 0.0031308 ? value * 12.92 : 1.055 * pow(value, 1.0 / 2.4) - 0.055) : value;
+			Guess[i] = (unsigned char)(stored * 255.0 + 0.5);
+		}
+	}
+
+	inline static float Decode(double value, bool srgb)
+	{
+		if (!srgb) return (float)value;
+		return (float)(value <= 0.04045 ? value / 12.92 : pow((value + 0.055) / 1.055, 2.4));
+	}
+
+	inline unsigned char Encode(float value) const
+	{
+		if (!(value > 0.0f)) return 0;
+		if (value >= 1.0f) return 255;
+		unsigned v = Guess[(unsigned)(value * 4096.0f)];
+		while (value >= Threshold[v + 1]) v++;
+		while (value < Threshold[v]) v--;
+		return (unsigned char)v;
+	}
+};
+
+static const color_tables &GetColorTables(bool srgb)
+{
+	static const color_tables srgbTables(true);
+	static const color_tables linearTables(false);
+	return srgb ? srgbTables : linearTables;
+}
+
+// The source pixels each output pixel along one axis is made from, and how much each counts.
+// Pixels past the edge are clamped, so every run of taps is inside the source.
+struct filter_taps
+{
+	std::vector<unsigned> Start;
+	std::vector<unsigned> Count;
+	std::vector<size_t> Offset;
+	std::vector<float> Weights;
+};
+
+static double Sinc(double x)
+{
+	if (fabs(x) < 1e-9) return 1.0;
+	x *= 3.14159265358979323846;
+	return sin(x) / x;
+}
+
+// Modified Bessel function of the first kind, for the Kaiser window.
+static double BesselI0(double x)
+{
+	double sum = 1.0;
+	double term = 1.0;
+	for (int k = 1; k < 32; k++)
+	{
+		term *= (x / (2.0 * k)) * (x / (2.0 * k));
+		sum += term;
+		if (term < sum * 1e-12) break;
+	}
+	return sum;
+}
+
+static double FilterWeight(mip_filter filter, double t)
+{
+	const double radius = 3.0;
+	if (fabs(t) >= radius) return 0.0;
+	if (filter == mip_filter::Lanczos) return Sinc(t) * Sinc(t / radius);
+
+	const double alpha = 4.0;
+	double ratio = t / radius;
+	return Sinc(t) * BesselI0(alpha * sqrt(1.0 - ratio * ratio)) / BesselI0(alpha);
+}
+
+static filter_taps ComputeTaps(unsigned sourceSize, unsigned destSize, mip_filter filter)
+{
+	filter_taps taps;
+	taps.Start.resize(destSize);
+	taps.Count.resize(destSize);
+	taps.Offset.resize(destSize);
+
+	double scale = (double)sourceSize / destSize;
+	std::vector<double> weights(sourceSize);
+	for (unsigned x = 0; x < destSize; x++)
+	{
+		for (double &weight : weights) weight = 0.0;
+		if (filter == mip_filter::Box)
+		{
+			// How much of each source pixel the output pixel covers.
+			double left = x * scale;
+			double right = (x + 1) * scale;
+			for (unsigned i = (unsigned)left; i < sourceSize && i < right; i++)
+			{
+				double overlap = (i + 1 < right ? i + 1 : right) - (i > left ? i : left);
+				if (overlap > 0.0) weights[i] += overlap;
+			}
+		}
+		else
+		{
+			double center = (x + 0.5) * scale;
+			double stretch = scale > 1.0 ? scale : 1.0;
+			int first = (int)floor(center - 3.0 * stretch);
+			int last = (int)ceil(center + 3.0 * stretch);
+			for (int i = first; i <= last; i++)
+			{
+				int clamped = i < 0 ? 0 : i >= (int)sourceSize ? (int)sourceSize - 1 : i;
+				weights[clamped] += FilterWeight(filter, (i + 0.5 - center) / stretch);
+			}
+		}
+
+		unsigned start = 0;
+		while (start + 1 < sourceSize && weights[start] == 0.0) start++;
+		unsigned end = sourceSize;
+		while (end > start + 1 && weights[end - 1] == 0.0) end--;
+
+		double sum = 0.0;
+		for (unsigned i = start; i < end; i++) sum += weights[i];
+		taps.Start[x] = start;
+		taps.Count[x] = end - start;
+		taps.Offset[x] = taps.Weights.size();
+		for (unsigned i = start; i < end; i++) taps.Weights.push_back((float)(weights[i] / sum));
+	}
+	return taps;
+}
+
+// dest[i] += source[i] * weight, over a whole number of RGBA pixels.
+static inline void MultiplyAdd(float *dest, const float *source, float weight, size_t pixels)
+{
+	size_t x = 0;
+#ifdef TC500_MIP_SSE2
+	__m128 w = _mm_set1_ps(weight);
+	for (; x + 2 <= pixels; x += 2)
+	{
+		_mm_storeu_ps(dest + x * 4, _mm_add_ps(_mm_loadu_ps(dest + x * 4), _mm_mul_ps(_mm_loadu_ps(source + x * 4), w)));
+		_mm_storeu_ps(dest + x * 4 + 4, _mm_add_ps(_mm_loadu_ps(dest + x * 4 + 4), _mm_mul_ps(_mm_loadu_ps(source + x * 4 + 4), w)));
+	}
+#endif
+	for (; x < pixels; x++)
+	{
+		for (unsigned c = 0; c < 4; c++) dest[x * 4 + c] += source[x * 4 + c] * weight;
+	}
+}
+
+// Filter one row across into the output width.
+static void FilterRow(float *dest, const float *source, const filter_taps &taps)
+{
+	for (size_t x = 0; x < taps.Start.size(); x++)
+	{
+		const float *pixel = source + (size_t)taps.Start[x] * 4;
+		const float *weight = taps.Weights.data() + taps.Offset[x];
+#ifdef TC500_MIP_SSE2
+		__m128 sum = _mm_setzero_ps();
+		for (unsigned i = 0; i < taps.Count[x]; i++)
+			sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(pixel + i * 4), _mm_set1_ps(weight[i])));
+		_mm_storeu_ps(dest + x * 4, sum);
+#else
+		float sum[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+		for (unsigned i = 0; i < taps.Count[x]; i++)
+		{
+			for (unsigned c = 0; c < 4; c++) sum[c] += pixel[i * 4 + c] * weight[i];
+		}
+		memcpy(dest + x * 4, sum, sizeof(sum));
+#endif
+	}
+}
+
+// Stored pixels to linear color multiplied by alpha.
+static void DecodeRow(float *dest, const unsigned char *source, size_t width, const color_tables &tables)
+{
+	for (size_t x = 0; x < width; x++)
+	{
+		float alpha = source[x * 4 + 3] * (1.0f / 255.0f);
+#ifdef TC500_MIP_SSE2
+		__m128 color = _mm_setr_ps(tables.ToLinear[source[x * 4]], tables.ToLinear[source[x * 4 + 1]], tables.ToLinear[source[x * 4 + 2]], 1.0f);
+		_mm_storeu_ps(dest + x * 4, _mm_mul_ps(color, _mm_set1_ps(alpha)));
+#else
+		for (unsigned c = 0; c < 3; c++) dest[x * 4 + c] = tables.ToLinear[source[x * 4 + c]] * alpha;
+		dest[x * 4 + 3] = alpha;
+#endif
+	}
+}
+
+// The reverse of DecodeRow().  Filters with negative lobes can overshoot, so values are clamped.
+static void EncodeRow(unsigned char *dest, const float *source, size_t width, const color_tables &tables)
+{
+	for (size_t x = 0; x < width; x++)
+	{
+		float alpha = source[x * 4 + 3];
+		if (alpha > 1.0f) alpha = 1.0f;
+		float scale = alpha > 0.0f ? 1.0f / alpha : 0.0f;
+		for (unsigned c = 0; c < 3; c++) dest[x * 4 + c] = tables.Encode(source[x * 4 + c] * scale);
+		dest[x * 4 + 3] = alpha > 0.0f ? (unsigned char)(alpha * 255.0f + 0.5f) : 0;
+	}
+}
+
+// Make one mip from the one above it.  The source is either stored pixels or, after the first
+// mip, the filtered values of the mip above, which keeps rounding from building up down the
+// chain.  Bands of output rows are done at the same time.  Each band filters across only the
+// source rows it needs, then down.
+static void FilterMip(const unsigned char *sourcePixels, const float *sourceValues, unsigned sourceWidth, unsigned sourceHeight, unsigned char *destPixels, float *destValues, unsigned destWidth, unsigned destHeight, mip_filter filter, const color_tables &tables)
+{
+	filter_taps across = ComputeTaps(sourceWidth, destWidth, filter);
+	filter_taps down = ComputeTaps(sourceHeight, destHeight, filter);
+
+	const size_t bandRows = 16;
+	size_t bandCount = (destHeight + bandRows - 1) / bandRows;
+	thread_pool::shared().parallel_for(bandCount, 1, [&](size_t beginBand, size_t endBand) {
+		std::vector<float> decoded(sourcePixels ? (size_t)sourceWidth * 4 : 0);
+		std::vector<float> rows;
+		std::vector<float> sum((size_t)destWidth * 4);
+		for (size_t band = beginBand; band < endBand; band++)
+		{
+			unsigned firstRow = (unsigned)(band * bandRows);
+			unsigned lastRow = firstRow + bandRows < destHeight ? firstRow + (unsigned)bandRows : destHeight;
+
+			// Source rows this band needs.
+			unsigned first = sourceHeight;
+			unsigned last = 0;
+			for (unsigned y = firstRow; y < lastRow; y++)
+			{
+				if (down.Start[y] < first) first = down.Start[y];
+				if (down.Start[y] + down.Count[y] > last) last = down.Start[y] + down.Count[y];
+			}
+
+			rows.resize((size_t)(last - first) * destWidth * 4);
+			for (unsigned y = first; y < last; y++)
+			{
+				const float *source;
+				if (sourcePixels)
+				{
+					DecodeRow(decoded.data(), sourcePixels + (size_t)y * sourceWidth * 4, sourceWidth, tables);
+					source = decoded.data();
+				}
+				else source = sourceValues + (size_t)y * sourceWidth * 4;
+				FilterRow(rows.data() + (size_t)(y - first) * destWidth * 4, source, across);
+			}
+
+			for (unsigned y = firstRow; y < lastRow; y++)
+			{
+				float *dest = destValues ? destValues + (size_t)y * destWidth * 4 : sum.data();
+				memset(dest, 0, (size_t)destWidth * 4 * sizeof(float));
+				const float *weight = down.Weights.data() + down.Offset[y];
+				for (unsigned i = 0; i < down.Count[y]; i++)
+					MultiplyAdd(dest, rows.data() + (size_t)(down.Start[y] + i - first) * destWidth * 4, weight[i], destWidth);
+				EncodeRow(destPixels + (size_t)y * destWidth * 4, dest, destWidth, tables);
+			}
+		}
+	});
+}
+
+// Replace the storage of a texture with one that has room for a full mip chain, keeping the
+// first mip of every element.
+static bool AddMipChain(texture_data &texture, texture_pool *pool)
+{
+	unsigned mipCount = 1;
+	while ((texture.Width >> mipCount) || (texture.Height >> mipCount)) mipCount++;
+
+	texture_data chain;
+	chain.initialize(mipCount, texture.ArrayCount);
+	if (!chain.Mips) return false;
+	chain.CubeMap = texture.CubeMap;
+	for (unsigned mip = 0; mip < mipCount; mip++)
+	{
+		chain.Mips[mip].Width = texture.Width >> mip ? texture.Width >> mip : 1;
+		chain.Mips[mip].Height = texture.Height >> mip ? texture.Height >> mip : 1;
+		chain.Mips[mip].BytesPerRow = chain.Mips[mip].Width * 4;
+		chain.Mips[mip].DataSize = chain.Mips[mip].BytesPerRow * chain.Mips[mip].Height;
+	}
+	if (!chain.generate_data(pool)) return false;
+	for (unsigned element = 0; element < texture.ArrayCount; element++)
+		memcpy(chain.get_data(0, element), texture.get_data(0, element), texture.Mips[0].DataSize);
+
+	// Trade storage with the new chain, which then frees the old one.
+	std::swap(texture.MipCount, chain.MipCount);
+	std::swap(texture.ImageCount, chain.ImageCount);
+	std::swap(texture.Mips, chain.Mips);
+	std::swap(texture.Data, chain.Data);
+	std::swap(texture.Storage, chain.Storage);
+	std::swap(texture.StorageSize, chain.StorageSize);
+	std::swap(texture.Pool, chain.Pool);
+	return true;
+}
+
+bool GenerateMips(texture_data &texture, mip_filter filter, bool srgb, texture_pool *pool)
+{
+	if (texture.Format != texture_format::RGBA_8888 && texture.Format != texture_format::BGRA_8888) return false;
+	if (!texture.Data || !texture.Mips || !texture.MipCount) return false;
+	if (texture.Mips[0].Width != texture.Width || texture.Mips[0].Height != texture.Height) return false;
+	if (texture.Mips[0].BytesPerRow != texture.Width * 4) return false;
+
+	if (texture.MipCount == 1 && (texture.Width > 1 || texture.Height > 1) && !AddMipChain(texture, pool)) return false;
+
+	// Each mip must be half the size of the one above it, rounded down.
+	for (unsigned mip = 1; mip < texture.MipCount; mip++)
+	{
+		unsigned width = texture.Mips[mip - 1].Width >> 1 ? texture.Mips[mip - 1].Width >> 1 : 1;
+		unsigned height = texture.Mips[mip - 1].Height >> 1 ? texture.Mips[mip - 1].Height >> 1 : 1;
+		if (texture.Mips[mip].Width != width || texture.Mips[mip].Height != height) return false;
+		if (texture.Mips[mip].BytesPerRow != width * 4) return false;
+	}
+
+	const color_tables &tables = GetColorTables(srgb);
+	thread_pool::shared().parallel_for(texture.ArrayCount, 1, [&](size_t beginElement, size_t endElement) {
+		std::vector<float> previous;
+		std::vector<float> current;
+		for (size_t element = beginElement; element < endElement; element++)
+		{
+			for (unsigned mip = 1; mip < texture.MipCount; mip++)
+			{
+				const mip_data &source = texture.Mips[mip - 1];
+				const mip_data &dest = texture.Mips[mip];
+
+				// The last mip has nothing below it that needs its values.
+				bool keep = mip + 1 < texture.MipCount;
+				current.resize(keep ? (size_t)dest.Width * dest.Height * 4 : 0);
+				FilterMip(mip == 1 ? texture.get_data(0, (unsigned)element) : nullptr, previous.data(), source.Width, source.Height, texture.get_data(mip, (unsigned)element), keep ? current.data() : nullptr, dest.Width, dest.Height, filter, tables);
+				std::swap(previous, current);
+			}
+		}
+	});
+	return true;
+}
+
+}}
@@ -0,0 +1,24 @@
+#pragma once
+#include "Graphics.h"
+
+namespace TChapman500 {
+namespace Graphics {
+
+enum class mip_filter
+{
+	Box,		// Average of the pixels each one covers.  Fast, a little blurry.
+	Kaiser,		// Kaiser-windowed sinc.  Sharper, with little ringing.
+	Lanczos		// Lanczos-3.  Sharpest, with some ringing at hard edges.
+};
+
+// Fill every mip after the first of each array element from that element's first mip.  If the
+// texture has only one mip, its storage is first replaced with a full chain down to 1x1, taken
+// from the pool if one is given.  Only RGBA_8888 and BGRA_8888 are supported.
+//
+// With srgb set, colors are filtered as linear light and stored back as sRGB.  Colors are
+// weighted by alpha, so transparent pixels do not bleed into their neighbors.  Odd sizes are
+// filtered properly rather than dropping the last row or column.  Array elements and cube faces
+// are done at the same time on the shared thread pool, as are bands of rows within each mip.
+bool GenerateMips(texture_data &texture, mip_filter filter = mip_filter::Box, bool srgb = true, texture_pool *pool = nullptr);
+
+}}
@@ -0,0 +1,380 @@
+#include "PNGFilters.h"
+#include <stdlib.h>
+#include <string.h>
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define TC500_PNG_SSE2
+#include <immintrin.h>
+#endif
+#if defined(__SSSE3__) || defined(__AVX__)
+#define TC500_PNG_SSSE3
+#endif
+
+namespace TChapman500 {
+namespace Graphics {
+
+static inline unsigned char PaethPredictor(unsigned char a, unsigned char b, unsigned char c)
+{
+	int p = (int)a + (int)b - (int)c;
+	int pa = abs(p - (int)a);
+	int pb = abs(p - (int)b);
+	int pc = abs(p - (int)c);
+	if (pa <= pb && pa <= pc) return a;
+	if (pb <= pc) return b;
+	return c;
+}
+
+void UnfilterScanlineScalar(unsigned char filter, unsigned char *scanline, const unsigned char *previous, size_t length, size_t bytesPerPixel)
+{
+	switch (filter)
+	{
+	case 0:		// No Filter
+		break;
+	case 1:		// Sub
+		for (size_t x = bytesPerPixel; x < length; x++)
+			scanline[x] += scanline[x - bytesPerPixel];
+		break;
+	case 2:		// Up
+		for (size_t x = 0; x < length; x++)
+			scanline[x] += previous[x];
+		break;
+	case 3:		// Average
+		for (size_t x = 0; x < bytesPerPixel && x < length; x++)
+			scanline[x] += previous[x] >> 1;
+		for (size_t x = bytesPerPixel; x < length; x++)
+			scanline[x] += (unsigned char)(((unsigned)scanline[x - bytesPerPixel] + previous[x]) >> 1);
+		break;
+	case 4:		// Paeth
+		for (size_t x = 0; x < bytesPerPixel && x < length; x++)
+			scanline[x] += previous[x];
+		for (size_t x = bytesPerPixel; x < length; x++)
+			scanline[x] += PaethPredictor(scanline[x - bytesPerPixel], previous[x], previous[x - bytesPerPixel]);
+		break;
+	}
+}
+
+void ExpandRGBScalar(unsigned char *dest, const unsigned char *source, size_t width)
+{
+	for (size_t x = 0; x < width; x++)
+	{
+		dest[x * 4 + 0] = source[x * 3 + 0];
+		dest[x * 4 + 1] = source[x * 3 + 1];
+		dest[x * 4 + 2] = source[x * 3 + 2];
+		dest[x * 4 + 3] = 255;
+	}
+}
+
+void ExpandGrayScalar(unsigned char *dest, const unsigned char *source, size_t width)
+{
+	for (size_t x = 0; x < width; x++)
+	{
+		dest[x * 4 + 0] = source[x];
+		dest[x * 4 + 1] = source[x];
+		dest[x * 4 + 2] = source[x];
+		dest[x * 4 + 3] = 255;
+	}
+}
+
+void ExpandGrayAlphaScalar(unsigned char *dest, const unsigned char *source, size_t width)
+{
+	for (size_t x = 0; x < width; x++)
+	{
+		dest[x * 4 + 0] = source[x * 2];
+		dest[x * 4 + 1] = source[x * 2];
+		dest[x * 4 + 2] = source[x * 2];
+		dest[x * 4 + 3] = source[x * 2 + 1];
+	}
+}
+
+void ExpandPaletteScalar(unsigned char *dest, const unsigned char *source, size_t width, const unsigned *palette)
+{
+	for (size_t x = 0; x < width; x++)
+		memcpy(dest + x * 4, &palette[source[x]], 4);
+}
+
+void ScaleSamples16Scalar(unsigned char *dest, const unsigned char *source, size_t count)
+{
+	for (size_t i = 0; i < count; i++)
+	{
+		unsigned value = ((unsigned)source[i * 2] << 8) | source[i * 2 + 1];
+		dest[i] = (unsigned char)((value * 255 + 32895) >> 16);
+	}
+}
+
+void UnpackSamples(unsigned char *dest, const unsigned char *source, size_t count, unsigned bitDepth, bool scale)
+{
+	unsigned perByte = 8 / bitDepth;
+	unsigned mask = (1 << bitDepth) - 1;
+	unsigned factor = scale ? 255 / mask : 1;
+	for (size_t i = 0; i < count; source++)
+	{
+		unsigned byte = *source;
+		for (unsigned j = 1; j <= perByte && i < count; j++, i++)
+			dest[i] = (unsigned char)(((byte >> (8 - bitDepth * j)) & mask) * factor);
+	}
+}
+
+#ifdef TC500_PNG_SSE2
+// Pixels are moved in and out of registers whole, without touching the bytes around them.
+template<size_t BPP> static inline __m128i LoadPixel(const unsigned char *data)
+{
+	int pixel;
+	if (BPP == 4) memcpy(&pixel, data, 4);
+	else pixel = (int)data[0] | ((int)data[1] << 8) | ((int)data[2] << 16);
+	return _mm_cvtsi32_si128(pixel);
+}
+
+template<size_t BPP> static inline void StorePixel(unsigned char *data, __m128i pixel)
+{
+	int value = _mm_cvtsi128_si32(pixel);
+	if (BPP == 4) memcpy(data, &value, 4);
+	else
+	{
+		data[0] = (unsigned char)value;
+		data[1] = (unsigned char)(value >> 8);
+		data[2] = (unsigned char)(value >> 16);
+	}
+}
+
+static void UnfilterUp(unsigned char *scanline, const unsigned char *previous, size_t length)
+{
+	size_t x = 0;
+#ifdef __AVX2__
+	for (; x + 32 <= length; x += 32)
+	{
+		__m256i sum = _mm256_add_epi8(_mm256_loadu_si256((const __m256i *)(scanline + x)), _mm256_loadu_si256((const __m256i *)(previous + x)));
+		_mm256_storeu_si256((__m256i *)(scanline + x), sum);
+	}
+#endif
+	for (; x + 16 <= length; x += 16)
+	{
+		__m128i sum = _mm_add_epi8(_mm_loadu_si128((const __m128i *)(scanline + x)), _mm_loadu_si128((const __m128i *)(previous + x)));
+		_mm_storeu_si128((__m128i *)(scanline + x), sum);
+	}
+	for (; x < length; x++) scanline[x] += previous[x];
+}
+
+// Sub is a running sum of pixels, so four pixels at a time are summed in two shifted adds and
+// the last pixel of the block is carried into the next one.
+static void UnfilterSub4(unsigned char *scanline, size_t length)
+{
+	__m128i last = _mm_setzero_si128();
+	size_t x = 0;
+	for (; x + 16 <= length; x += 16)
+	{
+		__m128i pixels = _mm_loadu_si128((const __m128i *)(scanline + x));
+		pixels = _mm_add_epi8(pixels, _mm_slli_si128(pixels, 4));
+		pixels = _mm_add_epi8(pixels, _mm_slli_si128(pixels, 8));
+		pixels = _mm_add_epi8(pixels, last);
+		_mm_storeu_si128((__m128i *)(scanline + x), pixels);
+		last = _mm_shuffle_epi32(pixels, 0xFF);
+	}
+	for (x = x < 4 ? 4 : x; x < length; x++) scanline[x] += scanline[x - 4];
+}
+
+static void UnfilterSub3(unsigned char *scanline, size_t length)
+{
+	__m128i last = _mm_setzero_si128();
+	size_t x = 0;
+	for (; x + 16 <= length; x += 12)
+	{
+		__m128i pixels = _mm_loadu_si128((const __m128i *)(scanline + x));
+		pixels = _mm_add_epi8(pixels, _mm_slli_si128(pixels, 3));
+		pixels = _mm_add_epi8(pixels, _mm_slli_si128(pixels, 6));
+		pixels = _mm_add_epi8(pixels, last);
+
+		// Only the four whole pixels are written back.
+		_mm_storel_epi64((__m128i *)(scanline + x), pixels);
+		StorePixel<4>(scanline + x + 8, _mm_srli_si128(pixels, 8));
+
+		last = _mm_cvtsi32_si128(_mm_cvtsi128_si32(_mm_srli_si128(pixels, 9)) & 0xFFFFFF);
+		last = _mm_or_si128(last, _mm_slli_si128(last, 3));
+		last = _mm_or_si128(last, _mm_slli_si128(last, 6));
+	}
+	for (x = x < 3 ? 3 : x; x < length; x++) scanline[x] += scanline[x - 3];
+}
+
+// Average and Paeth depend on the pixel just finished, so they work one pixel at a time with
+// all of its channels at once.
+template<size_t BPP> static void UnfilterAverage(unsigned char *scanline, const unsigned char *previous, size_t length)
+{
+	const __m128i one = _mm_set1_epi8(1);
+	__m128i a = _mm_setzero_si128();
+	for (size_t x = 0; x + BPP <= length; x += BPP)
+	{
+		// _mm_avg_epu8 rounds up, so take the rounding back off.
+		__m128i b = LoadPixel<BPP>(previous + x);
+		__m128i average = _mm_sub_epi8(_mm_avg_epu8(a, b), _mm_and_si128(_mm_xor_si128(a, b), one));
+		a = _mm_add_epi8(LoadPixel<BPP>(scanline + x), average);
+		StorePixel<BPP>(scanline + x, a);
+	}
+}
+
+template<size_t BPP> static void UnfilterPaeth(unsigned char *scanline, const unsigned char *previous, size_t length)
+{
+	const __m128i zero = _mm_setzero_si128();
+	__m128i a = zero;
+	__m128i c = zero;
+	for (size_t x = 0; x + BPP <= length; x += BPP)
+	{
+		// Channels are widened to 16 bits so the differences cannot overflow.
+		__m128i b = _mm_unpacklo_epi8(LoadPixel<BPP>(previous + x), zero);
+		__m128i pa = _mm_sub_epi16(b, c);
+		__m128i pb = _mm_sub_epi16(a, c);
+		__m128i pc = _mm_add_epi16(pa, pb);
+		pa = _mm_max_epi16(pa, _mm_sub_epi16(zero, pa));
+		pb = _mm_max_epi16(pb, _mm_sub_epi16(zero, pb));
+		pc = _mm_max_epi16(pc, _mm_sub_epi16(zero, pc));
+
+		// Same tie-breaking as PaethPredictor: a, then b, then c.
+		__m128i smallest = _mm_min_epi16(pc, _mm_min_epi16(pa, pb));
+		__m128i useA = _mm_cmpeq_epi16(pa, smallest);
+		__m128i useB = _mm_andnot_si128(useA, _mm_cmpeq_epi16(pb, smallest));
+		__m128i useC = _mm_andnot_si128(_mm_or_si128(useA, useB), _mm_set1_epi16(-1));
+		__m128i predictor = _mm_or_si128(_mm_or_si128(_mm_and_si128(useA, a), _mm_and_si128(useB, b)), _mm_and_si128(useC, c));
+
+		__m128i pixel = _mm_add_epi8(LoadPixel<BPP>(scanline + x), _mm_packus_epi16(predictor, predictor));
+		StorePixel<BPP>(scanline + x, pixel);
+		a = _mm_unpacklo_epi8(pixel, zero);
+		c = b;
+	}
+}
+#endif
+
+void UnfilterScanline(unsigned char filter, unsigned char *scanline, const unsigned char *previous, size_t length, size_t bytesPerPixel)
+{
+#ifdef TC500_PNG_SSE2
+	if (bytesPerPixel == 3 || bytesPerPixel == 4)
+	{
+		switch (filter)
+		{
+		case 0:		// No Filter
+			return;
+		case 1:		// Sub
+			if (bytesPerPixel == 4) UnfilterSub4(scanline, length);
+			else UnfilterSub3(scanline, length);
+			return;
+		case 2:		// Up
+			UnfilterUp(scanline, previous, length);
+			return;
+		case 3:		// Average
+			if (bytesPerPixel == 4) UnfilterAverage<4>(scanline, previous, length);
+			else UnfilterAverage<3>(scanline, previous, length);
+			return;
+		case 4:		// Paeth
+			if (bytesPerPixel == 4) UnfilterPaeth<4>(scanline, previous, length);
+			else UnfilterPaeth<3>(scanline, previous, length);
+			return;
+		}
+		return;
+	}
+	if (filter == 2)
+	{
+		UnfilterUp(scanline, previous, length);
+		return;
+	}
+#endif
+	UnfilterScanlineScalar(filter, scanline, previous, length, bytesPerPixel);
+}
+
+void ExpandRGB(unsigned char *dest, const unsigned char *source, size_t width)
+{
+	size_t x = 0;
+#ifdef TC500_PNG_SSSE3
+	// Spread each group of four pixels over 16 bytes and fill in the alpha.
+	const __m128i shuffle = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+	const __m128i alpha = _mm_set1_epi32((int)0xFF000000);
+#ifdef __AVX2__
+	const __m256i shuffle2 = _mm256_broadcastsi128_si256(shuffle);
+	const __m256i alpha2 = _mm256_set1_epi32((int)0xFF000000);
+	for (; (x + 8) * 3 + 4 <= width * 3; x += 8)
+	{
+		__m256i pixels = _mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)(source + x * 3)));
+		pixels = _mm256_inserti128_si256(pixels, _mm_loadu_si128((const __m128i *)(source + x * 3 + 12)), 1);
+		_mm256_storeu_si256((__m256i *)(dest + x * 4), _mm256_or_si256(_mm256_shuffle_epi8(pixels, shuffle2), alpha2));
+	}
+#endif
+	for (; (x + 4) * 3 + 4 <= width * 3; x += 4)
+	{
+		__m128i pixels = _mm_loadu_si128((const __m128i *)(source + x * 3));
+		_mm_storeu_si128((__m128i *)(dest + x * 4), _mm_or_si128(_mm_shuffle_epi8(pixels, shuffle), alpha));
+	}
+#endif
+	ExpandRGBScalar(dest + x * 4, source + x * 3, width - x);
+}
+
+void ExpandGray(unsigned char *dest, const unsigned char *source, size_t width)
+{
+	size_t x = 0;
+#ifdef TC500_PNG_SSE2
+	// Interleave each gray byte with itself and with 255, then the two pairs with each other.
+	const __m128i alpha = _mm_set1_epi8((char)0xFF);
+	for (; x + 16 <= width; x += 16)
+	{
+		__m128i gray = _mm_loadu_si128((const __m128i *)(source + x));
+		__m128i grayGray = _mm_unpacklo_epi8(gray, gray);
+		__m128i grayAlpha = _mm_unpacklo_epi8(gray, alpha);
+		_mm_storeu_si128((__m128i *)(dest + x * 4), _mm_unpacklo_epi16(grayGray, grayAlpha));
+		_mm_storeu_si128((__m128i *)(dest + x * 4 + 16), _mm_unpackhi_epi16(grayGray, grayAlpha));
+		grayGray = _mm_unpackhi_epi8(gray, gray);
+		grayAlpha = _mm_unpackhi_epi8(gray, alpha);
+		_mm_storeu_si128((__m128i *)(dest + x * 4 + 32), _mm_unpacklo_epi16(grayGray, grayAlpha));
+		_mm_storeu_si128((__m128i *)(dest + x * 4 + 48), _mm_unpackhi_epi16(grayGray, grayAlpha));
+	}
+#endif
+	ExpandGrayScalar(dest + x * 4, source + x, width - x);
+}
+
+void ExpandGrayAlpha(unsigned char *dest, const unsigned char *source, size_t width)
+{
+	size_t x = 0;
+#ifdef TC500_PNG_SSE2
+	// Each gray-alpha pair is one 16-bit lane.  Pair it with a copy that has gray in both bytes.
+	const __m128i lowByte = _mm_set1_epi16(0x00FF);
+	for (; x + 8 <= width; x += 8)
+	{
+		__m128i grayAlpha = _mm_loadu_si128((const __m128i *)(source + x * 2));
+		__m128i gray = _mm_and_si128(grayAlpha, lowByte);
+		__m128i grayGray = _mm_or_si128(gray, _mm_slli_epi16(gray, 8));
+		_mm_storeu_si128((__m128i *)(dest + x * 4), _mm_unpacklo_epi16(grayGray, grayAlpha));
+		_mm_storeu_si128((__m128i *)(dest + x * 4 + 16), _mm_unpackhi_epi16(grayGray, grayAlpha));
+	}
+#endif
+	ExpandGrayAlphaScalar(dest + x * 4, source + x * 2, width - x);
+}
+
+void ExpandPalette(unsigned char *dest, const unsigned char *source, size_t width, const unsigned *palette)
+{
+	size_t x = 0;
+#ifdef __AVX2__
+	for (; x + 8 <= width; x += 8)
+	{
+		__m256i indices = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(source + x)));
+		_mm256_storeu_si256((__m256i *)(dest + x * 4), _mm256_i32gather_epi32((const int *)palette, indices, 4));
+	}
+#endif
+	ExpandPaletteScalar(dest + x * 4, source + x, width - x, palette);
+}
+
+void ScaleSamples16(unsigned char *dest, const unsigned char *source, size_t count)
+{
+	size_t i = 0;
+#ifdef TC500_PNG_SSE2
+	// (value * 255 + 32895) >> 16 in 32-bit lanes, with value * 255 done as a shift and subtract.
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i round = _mm_set1_epi32(32895);
+	for (; i + 8 <= count; i += 8)
+	{
+		__m128i values = _mm_loadu_si128((const __m128i *)(source + i * 2));
+		values = _mm_or_si128(_mm_slli_epi16(values, 8), _mm_srli_epi16(values, 8));
+		__m128i low = _mm_unpacklo_epi16(values, zero);
+		__m128i high = _mm_unpackhi_epi16(values, zero);
+		low = _mm_srli_epi32(_mm_add_epi32(_mm_sub_epi32(_mm_slli_epi32(low, 8), low), round), 16);
+		high = _mm_srli_epi32(_mm_add_epi32(_mm_sub_epi32(_mm_slli_epi32(high, 8), high), round), 16);
+		__m128i words = _mm_packs_epi32(low, high);
+		_mm_storel_epi64((__m128i *)(dest + i), _mm_packus_epi16(words, words));
+	}
+#endif
+	ScaleSamples16Scalar(dest + i, source + i * 2, count - i);
+}
+
+}}
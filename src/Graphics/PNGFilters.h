@@ -0,0 +1,35 @@
+#pragma once
+#include <stddef.h>
+
+namespace TChapman500 {
+namespace Graphics {
+
+// Undo a PNG filter on one scanline, not counting its filter byte.  The previous scanline is
+// all zeros for the first row.  Pixels of 3 and 4 bytes use SSE2 when it is available.
+void UnfilterScanline(unsigned char filter, unsigned char *scanline, const unsigned char *previous, size_t length, size_t bytesPerPixel);
+
+// Expand RGB pixels to RGBA with an alpha of 255.  Uses SSSE3 or AVX2 when it is available.
+void ExpandRGB(unsigned char *dest, const unsigned char *source, size_t width);
+
+// Expand gray and gray-alpha pixels to RGBA.  Uses SSE2 when it is available.
+void ExpandGray(unsigned char *dest, const unsigned char *source, size_t width);
+void ExpandGrayAlpha(unsigned char *dest, const unsigned char *source, size_t width);
+
+// Look up palette indices in a table of 256 RGBA colors.  Uses AVX2 when it is available.
+void ExpandPalette(unsigned char *dest, const unsigned char *source, size_t width, const unsigned *palette);
+
+// Reduce big-endian 16-bit samples to 8 bits, rounding to nearest.  Uses SSE2 when it is available.
+void ScaleSamples16(unsigned char *dest, const unsigned char *source, size_t count);
+
+// Spread samples of 1, 2 or 4 bits into one byte each, optionally scaled up to the 0-255 range.
+void UnpackSamples(unsigned char *dest, const unsigned char *source, size_t count, unsigned bitDepth, bool scale);
+
+// Plain versions of the above, which the vector versions must match exactly.
+void UnfilterScanlineScalar(unsigned char filter, unsigned char *scanline, const unsigned char *previous, size_t length, size_t bytesPerPixel);
+void ExpandRGBScalar(unsigned char *dest, const unsigned char *source, size_t width);
+void ExpandGrayScalar(unsigned char *dest, const unsigned char *source, size_t width);
+void ExpandGrayAlphaScalar(unsigned char *dest, const unsigned char *source, size_t width);
+void ExpandPaletteScalar(unsigned char *dest, const unsigned char *source, size_t width, const unsigned *palette);
+void ScaleSamples16Scalar(unsigned char *dest, const unsigned char *source, size_t count);
+
+}}
@@ -61,18 +61,10 @@ inline unsigned getDataSize(texture_format format, mip_data *mip)
 	switch (format)
 	{
 	case texture_format::DXT1:
-	{
-		unsigned bpr = 8 * (mip->Width / 4);
-		if (mip->Width % 4 != 0) bpr += 8;
-		return bpr;
-	}
 	case texture_format::DXT3:
 	case texture_format::DXT5:
-	{
-		unsigned bpr = 16 * (mip->Width / 4);
-		if (mip->Width % 4 != 0) bpr += 16;
-		return bpr;
-	}
+		// One row of blocks covers four rows of pixels.
+		return mip->BytesPerRow * ((mip->Height + 3) / 4);
 	}
 
 	// The final result.
@@ -81,11 +73,11 @@ inline unsigned getDataSize(texture_format format, mip_data *mip)
 inline bool verifyMip(unsigned width, unsigned height, texture_format format, unsigned mipIndex, mip_data *mip)
 {
 	// Expected with of the mip in pixels.
-	unsigned expectedWidth = mip->Width >> mipIndex;
+	unsigned expectedWidth = width >> mipIndex;
 	if (expectedWidth == 0) expectedWidth = 1;
 
 	// Expected height of the mip in pixels.
-	unsigned expectedHeight = mip->Height >> mipIndex;
+	unsigned expectedHeight = height >> mipIndex;
 	if (expectedHeight == 0) expectedHeight = 1;
 
 	// Verify that the mip meets the expected parameters.
@@ -201,16 +193,15 @@ public:
 			// Generate subresource data and create the texture.
 			unsigned subCount = texDesc.ArraySize * texDesc.MipLevels;
 			D3D11_SUBRESOURCE_DATA *subData = new D3D11_SUBRESOURCE_DATA[subCount];
-			for (unsigned i = 0, mip = 0, side = 0; i < subCount; i++)
+			for (unsigned i = 0, mip = 0; i < subCount; i++)
 			{
-				// Get side and mip index
-				side = i % MipCount;
-				mip = i - (side * MipCount);
+				// Get mip index
+				mip = i % MipCount;
 
 				// Populate data field.
-				subData->SysMemPitch = data.Mips[mip].BytesPerRow;
-				subData->SysMemSlicePitch = 0;
-				subData->pSysMem = data.Data[i];
+				subData[i].SysMemPitch = data.Mips[mip].BytesPerRow;
+				subData[i].SysMemSlicePitch = 0;
+				subData[i].pSysMem = data.Data[i];
 			}
 			HRESULT result = Device->CreateTexture2D(&texDesc, subData, &ITexture);
 			delete[] subData;
@@ -384,8 +375,10 @@ public:
 		// Populate texture data
 		(*texData)->Format = formatConverter(Format);
 		(*texData)->CubeMap = CubeMap;
-		(*texData)->MipCount = MipCount;
-		(*texData)->Mips = new mip_data[MipCount];
+		(*texData)->Width = Width;
+		(*texData)->Height = Height;
+		(*texData)->initialize(MipCount, CubeMap ? 6 : 1);
+		if (!(*texData)->Mips) return false;
 		(*texData)->Transparent = Transparent;
 		for (unsigned i = 0; i < MipCount; i++)
 		{
@@ -396,7 +389,7 @@ public:
 		}
 
 		// Populate Texture Data.
-		(*texData)->Data = new unsigned char *[CubeMap ? MipCount * 6 : MipCount];
+		if (!(*texData)->generate_data()) return false;
 
 		// Map the data.
 		D3D11_MAPPED_SUBRESOURCE data;
@@ -406,13 +399,9 @@ public:
 
 		// Map the texture data.
 		unsigned maxCount = CubeMap ? MipCount * 6 : MipCount;
-		for (unsigned i = 0, mip = 0, side = 0; i < maxCount; i++)
+		for (unsigned i = 0, mip = 0; i < maxCount; i++)
 		{
-			side = i % MipCount;
-			mip = i - (side * MipCount);
-
-			// Allocate memory.
-			(*texData)->Data[i] = new unsigned char[MipData[mip].DataSize];
+			mip = i % MipCount;
 
 			// Begin read
 			HRESULT result = Context->Map(ITexture, i, D3D11_MAP::D3D11_MAP_READ, NULL, &data);
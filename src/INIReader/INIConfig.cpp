@@ -0,0 +1,191 @@
+#include "INIConfig.h"
+#include <unordered_set>
+
+#include "INISection.h"
+#include "INIKey.h"
+#include "../thread_pool.h"
+
+namespace TChapman500 {
+INIConfig::INIConfig(const std::vector<std::wstring> &paths, bool parallel)
+{
+	Layers.resize(paths.size());
+	for (size_t i = 0; i < paths.size(); i++) Layers[i].Path = paths[i];
+
+	// Each layer is parsed on its own, so they can all be read at the same time.
+	auto load = [this](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i++) Layers[i].File = std::make_unique<INIFile>(std::wstring(Layers[i].Path));
+	};
+	if (parallel && Layers.size() > 1) thread_pool::shared().parallel_for(Layers.size(), 1, load);
+	else load(0, Layers.size());
+
+	_Merge();
+}
+
+INIConfig::~INIConfig() {}
+
+size_t INIConfig::GetLayerCount() { return Layers.size(); }
+
+const std::wstring &INIConfig::GetLayerPath(size_t layer)
+{
+	static const std::wstring empty;
+	if (layer >= Layers.size()) return empty;
+	return Layers[layer].Path;
+}
+
+INIFile *INIConfig::GetLayerFile(size_t layer)
+{
+	if (layer >= Layers.size()) return nullptr;
+	return Layers[layer].File.get();
+}
+
+size_t INIConfig::GetLayer(std::wstring_view section, std::wstring_view key)
+{
+	const entry *found = _Find(INIFile::_Hash(section, key), section, key);
+	if (!found) return InvalidLayer;
+	return found->Layer;
+}
+
+size_t INIConfig::GetLayer(const INIFile::key_handle &handle)
+{
+	const entry *found = _Find(handle.Hash, handle.Section, handle.Key);
+	if (!found) return InvalidLayer;
+	return found->Layer;
+}
+
+long long INIConfig::GetInt(std::wstring_view section, std::wstring_view key, long long def)
+{
+	INIKey *iKey = GetKey(section, key);
+	if (!iKey) return def;
+	return iKey->GetInt();
+}
+
+long long INIConfig::GetInt(const INIFile::key_handle &handle, long long def)
+{
+	INIKey *iKey = GetKey(handle);
+	if (!iKey) return def;
+	return iKey->GetInt();
+}
+
+unsigned long long INIConfig::GetUInt(std::wstring_view section, std::wstring_view key, unsigned long long def)
+{
+	INIKey *iKey = GetKey(section, key);
+	if (!iKey) return def;
+	return iKey->GetUInt();
+}
+
+unsigned long long INIConfig::GetUInt(const INIFile::key_handle &handle, unsigned long long def)
+{
+	INIKey *iKey = GetKey(handle);
+	if (!iKey) return def;
+	return iKey->GetUInt();
+}
+
+double INIConfig::GetFloat(std::wstring_view section, std::wstring_view key, double def)
+{
+	INIKey *iKey = GetKey(section, key);
+	if (!iKey) return def;
+	return iKey->GetFloat();
+}
+
+double INIConfig::GetFloat(const INIFile::key_handle &handle, double def)
+{
+	INIKey *iKey = GetKey(handle);
+	if (!iKey) return def;
+	return iKey->GetFloat();
+}
+
+std::wstring INIConfig::GetString(std::wstring_view section, std::wstring_view key)
+{
+	INIKey *iKey = GetKey(section, key);
+	if (!iKey) return std::wstring();
+	return iKey->GetValue();
+}
+
+std::wstring INIConfig::GetString(const INIFile::key_handle &handle)
+{
+	INIKey *iKey = GetKey(handle);
+	if (!iKey) return std::wstring();
+	return iKey->GetValue();
+}
+
+INIKey *INIConfig::GetKey(std::wstring_view section, std::wstring_view key)
+{
+	const entry *found = _Find(INIFile::_Hash(section, key), section, key);
+	if (!found) return nullptr;
+	return found->Key;
+}
+
+INIKey *INIConfig::GetKey(const INIFile::key_handle &handle)
+{
+	const entry *found = _Find(handle.Hash, handle.Section, handle.Key);
+	if (!found) return nullptr;
+	return found->Key;
+}
+
+const INIConfig::entry *INIConfig::_Find(size_t hash, std::wstring_view section, std::wstring_view key)
+{
+	if (Table.empty()) return nullptr;
+
+	size_t mask = Table.size() - 1;
+	for (size_t i = hash & mask; ; i = (i + 1) & mask)
+	{
+		const entry &found = Table[i];
+		if (!found.Key) return nullptr;
+		if (found.Hash == hash && found.Key->GetName() == key && found.Section->GetName() == section)
+			return &found;
+	}
+}
+
+void INIConfig::_Merge()
+{
+	size_t keyCount = 0;
+	for (const layer &source : Layers)
+	{
+		for (size_t i = 0; i < source.File->GetSectionCount(); i++)
+			keyCount += source.File->GetSection(i)->GetKeyCount();
+	}
+
+	// Keep the table at most half full.
+	size_t tableSize = 16;
+	while (tableSize < keyCount * 2) tableSize <<= 1;
+	Table.assign(tableSize, entry{ 0, nullptr, nullptr, InvalidLayer });
+
+	// Start from the top layer, so the first entry for a key is always the one that wins.
+	size_t mask = tableSize - 1;
+	for (size_t l = Layers.size(); l > 0; l--)
+	{
+		INIFile *file = Layers[l - 1].File.get();
+
+		// Only the first section with a given name is ever looked at.
+		std::unordered_set<std::wstring_view> seen;
+		for (size_t i = 0; i < file->GetSectionCount(); i++)
+		{
+			INISection *section = file->GetSection(i);
+			if (!seen.insert(section->GetName()).second) continue;
+
+			for (size_t k = 0; k < section->GetKeyCount(); k++)
+			{
+				INIKey *key = section->GetKey(k);
+				size_t hash = INIFile::_Hash(section->GetName(), key->GetName());
+				size_t slot = hash & mask;
+				bool overridden = false;
+				for (; Table[slot].Key; slot = (slot + 1) & mask)
+				{
+					const entry &found = Table[slot];
+					if (found.Hash == hash && found.Key->GetName() == key->GetName() && found.Section->GetName() == section->GetName())
+					{
+						overridden = true;
+						break;
+					}
+				}
+				if (overridden) continue;
+
+				Table[slot].Hash = hash;
+				Table[slot].Section = section;
+				Table[slot].Key = key;
+				Table[slot].Layer = l - 1;
+			}
+		}
+	}
+}
+}
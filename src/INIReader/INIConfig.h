@@ -0,0 +1,72 @@
+#pragma once
+#include <string>
+#include <string_view>
+#include <vector>
+#include <memory>
+#include "INIFile.h"
+
+namespace TChapman500 {
+class INIKey;
+class INISection;
+
+// Several INI files stacked on top of each other, such as defaults, site and host settings.
+// Later layers override earlier ones.  Every layer is merged into one hash table when the
+// config is loaded, so a lookup is a single probe no matter how many layers there are, and
+// each key remembers which layer it came from.
+class INIConfig
+{
+public:
+	static constexpr size_t InvalidLayer = ~(size_t)0;
+
+	// Files that cannot be opened are treated as empty layers.
+	INIConfig(const std::vector<std::wstring> &paths, bool parallel = true);
+	~INIConfig();
+
+	INIConfig(const INIConfig &) = delete;
+	INIConfig &operator=(const INIConfig &) = delete;
+
+	size_t GetLayerCount();
+	const std::wstring &GetLayerPath(size_t layer);
+	INIFile *GetLayerFile(size_t layer);
+
+	// Layer that a key's value came from, or InvalidLayer if no layer has it.
+	size_t GetLayer(std::wstring_view section, std::wstring_view key);
+	size_t GetLayer(const INIFile::key_handle &handle);
+
+	long long GetInt(std::wstring_view section, std::wstring_view key, long long def);
+	long long GetInt(const INIFile::key_handle &handle, long long def);
+
+	unsigned long long GetUInt(std::wstring_view section, std::wstring_view key, unsigned long long def);
+	unsigned long long GetUInt(const INIFile::key_handle &handle, unsigned long long def);
+
+	double GetFloat(std::wstring_view section, std::wstring_view key, double def);
+	double GetFloat(const INIFile::key_handle &handle, double def);
+
+	std::wstring GetString(std::wstring_view section, std::wstring_view key);
+	std::wstring GetString(const INIFile::key_handle &handle);
+
+	INIKey *GetKey(std::wstring_view section, std::wstring_view key);
+	INIKey *GetKey(const INIFile::key_handle &handle);
+
+private:
+	struct layer
+	{
+		std::wstring Path;
+		std::unique_ptr<INIFile> File;
+	};
+
+	struct entry
+	{
+		size_t Hash;
+		INISection *Section;
+		INIKey *Key;
+		size_t Layer;
+	};
+
+	std::vector<layer> Layers;
+	std::vector<entry> Table;
+
+	const entry *_Find(size_t hash, std::wstring_view section, std::wstring_view key);
+	void _Merge();
+};
+}
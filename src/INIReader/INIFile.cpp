@@ -1,5 +1,8 @@
 #include "INIFile.h"
 #include <fstream>
+#include <filesystem>
+#include <string.h>
+#include <unordered_set>
 
 #include "INISection.h"
 #include "INIKey.h"
@@ -7,70 +10,338 @@
 namespace TChapman500 {
 INIFile::INIFile(std::wstring path) { _Initialize(path); }
 INIFile::INIFile(std::wstring &path) { _Initialize(path); }
+INIFile::INIFile(const std::wstring &path, const std::wstring &cachePath)
+{
+	if (_LoadCache(path, cachePath)) return;
+
+	std::wstring textPath = path;
+	_Initialize(textPath);
+	if (!Sections.empty()) SaveCache(cachePath);
+}
+
 INIFile::~INIFile() {}
 
-long long INIFile::GetInt(std::wstring &section, std::wstring &key, long long def) { return _GetInt(section, key, def); }
-long long INIFile::GetInt(std::wstring &section, std::wstring key, long long def) { return _GetInt(section, key, def); }
-long long INIFile::GetInt(std::wstring section, std::wstring &key, long long def) { return _GetInt(section, key, def); }
-long long INIFile::GetInt(std::wstring section, std::wstring key, long long def) { return _GetInt(section, key, def); }
+bool INIFile::SaveCache(const std::wstring &cachePath)
+{
+	cache_header header;
+	memset(&header, 0, sizeof(cache_header));
+	header.Magic = 0x424E4954;	// TINB
+	header.Version = 2;
+	header.CharSize = sizeof(wchar_t);
+	if (!_GetSourceStamp(SourcePath, header.SourceSize, header.SourceTime)) return false;
+
+	std::vector<cache_section> sections(Sections.size());
+	std::vector<cache_key> keys;
+	std::wstring pool;
+	for (size_t i = 0; i < Sections.size(); i++)
+	{
+		INISection *section = Sections[i].get();
+		sections[i].Name = (unsigned)pool.size();
+		sections[i].NameLength = (unsigned)section->Name.size();
+		sections[i].KeyCount = (unsigned)section->Keys.size();
+		pool += section->Name;
+
+		for (const std::unique_ptr<INIKey> &iKey : section->Keys)
+		{
+			// Typed values are stored as parsed so that loading the cache never has to parse.
+			cache_key key;
+			memset(&key, 0, sizeof(cache_key));
+			key.Name = (unsigned)pool.size();
+			key.NameLength = (unsigned)iKey->Key.size();
+			pool += iKey->Key;
+			key.Value = (unsigned)pool.size();
+			key.ValueLength = (unsigned)iKey->Value.size();
+			pool += iKey->Value;
+			key.Valid = iKey->Valid;
+			key.IntValue = iKey->IntValue;
+			key.UIntValue = iKey->UIntValue;
+			key.FloatValue = iKey->FloatValue;
+			keys.push_back(key);
+		}
+	}
+	header.SectionCount = (unsigned)sections.size();
+	header.KeyCount = (unsigned)keys.size();
+	header.PoolLength = (unsigned)pool.size();
+
+	// Write to a temporary file first so that a reader never sees half a cache.
+	std::filesystem::path finalPath(cachePath);
+	std::filesystem::path tempPath(cachePath + L".tmp");
+	bool written;
+	{
+		std::fstream file(tempPath, std::ios::out | std::ios::binary | std::ios::trunc);
+		if (!file.is_open()) return false;
+		file.write((const char *)&header, sizeof(cache_header));
+		file.write((const char *)sections.data(), sizeof(cache_section) * sections.size());
+		file.write((const char *)keys.data(), sizeof(cache_key) * keys.size());
+		file.write((const char *)pool.data(), sizeof(wchar_t) * pool.size());
+		file.close();
+		written = !file.fail();
+	}
 
-unsigned long long INIFile::GetUInt(std::wstring &section, std::wstring &key, unsigned long long def) { return _GetUInt(section, key, def); }
-unsigned long long INIFile::GetUInt(std::wstring &section, std::wstring key, unsigned long long def) { return _GetUInt(section, key, def); }
-unsigned long long INIFile::GetUInt(std::wstring section, std::wstring &key, unsigned long long def) { return _GetUInt(section, key, def); }
-unsigned long long INIFile::GetUInt(std::wstring section, std::wstring key, unsigned long long def) { return _GetUInt(section, key, def); }
+	std::error_code error;
+	if (written) std::filesystem::rename(tempPath, finalPath, error);
+	if (written && !error) return true;
 
-double INIFile::GetFloat(std::wstring &section, std::wstring &key, double def) { return _GetFloat(section, key, def); }
-double INIFile::GetFloat(std::wstring &section, std::wstring key, double def) { return _GetFloat(section, key, def); }
-double INIFile::GetFloat(std::wstring section, std::wstring &key, double def) { return _GetFloat(section, key, def); }
-double INIFile::GetFloat(std::wstring section, std::wstring key, double def) { return _GetFloat(section, key, def); }
+	// Don't leave half a cache lying around.
+	std::filesystem::remove(tempPath, error);
+	return false;
+}
 
-std::wstring INIFile::GetString(std::wstring &section, std::wstring &key) { return _GetString(section, key); }
-std::wstring INIFile::GetString(std::wstring &section, std::wstring key) { return _GetString(section, key); }
-std::wstring INIFile::GetString(std::wstring section, std::wstring &key) { return _GetString(section, key); }
-std::wstring INIFile::GetString(std::wstring section, std::wstring key) { return _GetString(section, key); }
+INIFile::key_handle INIFile::GetHandle(std::wstring_view section, std::wstring_view key)
+{
+	key_handle result;
+	result.Hash = _Hash(section, key);
+	result.Section = section;
+	result.Key = key;
+	return result;
+}
 
-long long INIFile::_GetInt(std::wstring &section, std::wstring &key, long long def)
+long long INIFile::GetInt(std::wstring_view section, std::wstring_view key, long long def)
 {
-	for (size_t i = 0; i < Sections.size(); i++)
+	INIKey *iKey = _Find(_Hash(section, key), section, key);
+	if (!iKey) return def;
+	return iKey->GetInt();
+}
+
+long long INIFile::GetInt(const key_handle &handle, long long def)
+{
+	INIKey *iKey = GetKey(handle);
+	if (!iKey) return def;
+	return iKey->GetInt();
+}
+
+unsigned long long INIFile::GetUInt(std::wstring_view section, std::wstring_view key, unsigned long long def)
+{
+	INIKey *iKey = _Find(_Hash(section, key), section, key);
+	if (!iKey) return def;
+	return iKey->GetUInt();
+}
+
+unsigned long long INIFile::GetUInt(const key_handle &handle, unsigned long long def)
+{
+	INIKey *iKey = GetKey(handle);
+	if (!iKey) return def;
+	return iKey->GetUInt();
+}
+
+double INIFile::GetFloat(std::wstring_view section, std::wstring_view key, double def)
+{
+	INIKey *iKey = _Find(_Hash(section, key), section, key);
+	if (!iKey) return def;
+	return iKey->GetFloat();
+}
+
+double INIFile::GetFloat(const key_handle &handle, double def)
+{
+	INIKey *iKey = GetKey(handle);
+	if (!iKey) return def;
+	return iKey->GetFloat();
+}
+
+std::wstring INIFile::GetString(std::wstring_view section, std::wstring_view key)
+{
+	INIKey *iKey = _Find(_Hash(section, key), section, key);
+	if (!iKey) return std::wstring();
+	return iKey->GetValue();
+}
+
+std::wstring INIFile::GetString(const key_handle &handle)
+{
+	INIKey *iKey = GetKey(handle);
+	if (!iKey) return std::wstring();
+	return iKey->GetValue();
+}
+
+INIKey *INIFile::GetKey(std::wstring_view section, std::wstring_view key) { return _Find(_Hash(section, key), section, key); }
+INIKey *INIFile::GetKey(const key_handle &handle) { return _Find(handle.Hash, handle.Section, handle.Key); }
+
+INIKey *INIFile::SetValue(std::wstring_view section, std::wstring_view key, std::wstring_view value)
+{
+	INIKey *iKey = _Find(_Hash(section, key), section, key);
+	if (iKey)
 	{
-		if (Sections[i]->GetName() == section)
-			return Sections[i]->GetInt(key, def);
+		iKey->SetValue(std::wstring(value));
+		return iKey;
 	}
-	return def;
+	if (key.empty()) return nullptr;
+
+	INISection *iSection = GetSection(section);
+	if (!iSection)
+	{
+		std::unique_ptr<INISection> newSection(new INISection());
+		newSection->Name = section;
+		iSection = newSection.get();
+		Sections.push_back(std::move(newSection));
+	}
+
+	std::unique_ptr<INIKey> newKey(new INIKey());
+	newKey->Key = key;
+	newKey->Value = value;
+	newKey->_Parse();
+	iKey = newKey.get();
+	iSection->Keys.push_back(std::move(newKey));
+
+	// New keys are rare, so just build the index again.
+	_BuildIndex();
+	return iKey;
 }
 
-unsigned long long INIFile::_GetUInt(std::wstring &section, std::wstring &key, unsigned long long def)
+const std::wstring &INIFile::GetPath() { return SourcePath; }
+size_t INIFile::GetSectionCount() { return Sections.size(); }
+
+INISection *INIFile::GetSection(size_t index)
 {
-	for (size_t i = 0; i < Sections.size(); i++)
+	if (index >= Sections.size()) return nullptr;
+	return Sections[index].get();
+}
+
+INISection *INIFile::GetSection(std::wstring_view name)
+{
+	for (const std::unique_ptr<INISection> &section : Sections)
 	{
-		if (Sections[i]->GetName() == section)
-			return Sections[i]->GetUInt(key, def);
+		if (section->GetName() == name)
+			return section.get();
 	}
-	return def;
+	return nullptr;
 }
 
-double INIFile::_GetFloat(std::wstring &section, std::wstring &key, double def)
+size_t INIFile::_Hash(std::wstring_view section, std::wstring_view key)
 {
-	for (size_t i = 0; i < Sections.size(); i++)
+	size_t sectionHash = std::hash<std::wstring_view>()(section);
+	size_t keyHash = std::hash<std::wstring_view>()(key);
+	// The golden ratio as a fraction of the range of size_t.
+	const size_t golden = sizeof(size_t) == 8 ? (size_t)0x9E3779B97F4A7C15ULL : (size_t)0x9E3779B9U;
+	return sectionHash ^ (keyHash + golden + (sectionHash << 6) + (sectionHash >> 2));
+}
+
+INIKey *INIFile::_Find(size_t hash, std::wstring_view section, std::wstring_view key)
+{
+	if (KeyIndex.empty()) return nullptr;
+
+	size_t mask = KeyIndex.size() - 1;
+	for (size_t i = hash & mask; ; i = (i + 1) & mask)
 	{
-		if (Sections[i]->GetName() == section)
-			return Sections[i]->GetFloat(key, def);
+		const key_index_entry &entry = KeyIndex[i];
+		if (!entry.Key) return nullptr;
+		if (entry.Hash == hash && entry.Key->GetName() == key && entry.Section->GetName() == section)
+			return entry.Key;
 	}
-	return def;
 }
 
-std::wstring INIFile::_GetString(std::wstring &section, std::wstring &key)
+void INIFile::_BuildIndex()
 {
+	size_t keyCount = 0;
+	for (const std::unique_ptr<INISection> &section : Sections) keyCount += section->GetKeyCount();
+
+	// Keep the table at most half full.
+	size_t tableSize = 16;
+	while (tableSize < keyCount * 2) tableSize <<= 1;
+	KeyIndex.assign(tableSize, key_index_entry{ 0, nullptr, nullptr });
+
+	size_t mask = tableSize - 1;
+	std::unordered_set<std::wstring_view> seen;
 	for (size_t i = 0; i < Sections.size(); i++)
 	{
-		if (Sections[i]->GetName() == section)
-			return Sections[i]->GetString(key);
+		INISection *section = Sections[i].get();
+
+		// Only the first section with a given name is ever looked at.
+		if (!seen.insert(section->GetName()).second) continue;
+
+		for (size_t k = 0; k < section->GetKeyCount(); k++)
+		{
+			INIKey *key = section->GetKey(k);
+			size_t hash = _Hash(section->GetName(), key->GetName());
+			size_t slot = hash & mask;
+			while (KeyIndex[slot].Key) slot = (slot + 1) & mask;
+
+			KeyIndex[slot].Hash = hash;
+			KeyIndex[slot].Section = section;
+			KeyIndex[slot].Key = key;
+		}
 	}
-	return std::wstring();
+}
+
+bool INIFile::_GetSourceStamp(const std::wstring &path, unsigned long long &size, long long &time)
+{
+	std::error_code error;
+	std::filesystem::path sourcePath(path);
+	size = (unsigned long long)std::filesystem::file_size(sourcePath, error);
+	if (error) return false;
+	time = (long long)std::filesystem::last_write_time(sourcePath, error).time_since_epoch().count();
+	return !error;
+}
+
+bool INIFile::_LoadCache(const std::wstring &path, const std::wstring &cachePath)
+{
+	SourcePath = path;
+
+	unsigned long long sourceSize;
+	long long sourceTime;
+	if (!_GetSourceStamp(path, sourceSize, sourceTime)) return false;
+
+	std::fstream file(std::filesystem::path(cachePath), std::ios::in | std::ios::binary);
+	if (!file.is_open()) return false;
+
+	// The cache must have been made from this exact version of the file.
+	cache_header header;
+	file.read((char *)&header, sizeof(cache_header));
+	if (!file || header.Magic != 0x424E4954 || header.Version != 2 || header.CharSize != sizeof(wchar_t)) return false;
+	if (header.SourceSize != sourceSize || header.SourceTime != sourceTime) return false;
+
+	// The counts must match the size of the file before anything is allocated from them, so a
+	// truncated or damaged cache falls back to the text.
+	std::error_code error;
+	unsigned long long cacheSize = std::filesystem::file_size(std::filesystem::path(cachePath), error);
+	unsigned long long expectedSize = sizeof(cache_header) + (unsigned long long)header.SectionCount * sizeof(cache_section)
+		+ (unsigned long long)header.KeyCount * sizeof(cache_key) + (unsigned long long)header.PoolLength * sizeof(wchar_t);
+	if (error || cacheSize != expectedSize) return false;
+
+	std::vector<cache_section> sections(header.SectionCount);
+	std::vector<cache_key> keys(header.KeyCount);
+	std::wstring pool(header.PoolLength, L'\0');
+	file.read((char *)sections.data(), sizeof(cache_section) * sections.size());
+	file.read((char *)keys.data(), sizeof(cache_key) * keys.size());
+	file.read((char *)pool.data(), sizeof(wchar_t) * pool.size());
+	if (!file) return false;
+
+	auto inPool = [&pool](unsigned offset, unsigned length) { return (size_t)offset + length <= pool.size(); };
+
+	std::vector<std::unique_ptr<INISection>> loaded;
+	loaded.reserve(sections.size());
+	size_t nextKey = 0;
+	for (const cache_section &section : sections)
+	{
+		if (!inPool(section.Name, section.NameLength) || nextKey + section.KeyCount > keys.size()) return false;
+
+		std::unique_ptr<INISection> newSection(new INISection());
+		newSection->Name.assign(pool, section.Name, section.NameLength);
+		newSection->Keys.reserve(section.KeyCount);
+		for (unsigned i = 0; i < section.KeyCount; i++)
+		{
+			const cache_key &key = keys[nextKey++];
+			if (!inPool(key.Name, key.NameLength) || !inPool(key.Value, key.ValueLength)) return false;
+
+			std::unique_ptr<INIKey> newKey(new INIKey());
+			newKey->Key.assign(pool, key.Name, key.NameLength);
+			newKey->Value.assign(pool, key.Value, key.ValueLength);
+			newKey->Valid = (unsigned char)key.Valid;
+			newKey->IntValue = key.IntValue;
+			newKey->UIntValue = key.UIntValue;
+			newKey->FloatValue = key.FloatValue;
+			newSection->Keys.push_back(std::move(newKey));
+		}
+		loaded.push_back(std::move(newSection));
+	}
+
+	Sections = std::move(loaded);
+	_BuildIndex();
+	return true;
 }
 
 void INIFile::_Initialize(std::wstring &path)
 {
+	SourcePath = path;
+
 	std::wfstream file(path, std::ios::in);
 	if (!file.is_open()) return;
 
@@ -106,5 +377,6 @@ void INIFile::_Initialize(std::wstring &path)
 
 	// End of file
 	if (currSection) Sections.push_back(std::move(currSection));
+	_BuildIndex();
 }
 }
\ No newline at end of file
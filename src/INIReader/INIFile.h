@@ -1,5 +1,6 @@
 #pragma once
 #include <string>
+#include <string_view>
 #include <vector>
 #include <memory>
 
@@ -11,36 +12,100 @@ class INIFile
 public:
 	INIFile(std::wstring path);
 	INIFile(std::wstring &path);
+
+	// Load from a binary cache of the file if it is up to date, otherwise parse the text and
+	// write a new cache.
+	INIFile(const std::wstring &path, const std::wstring &cachePath);
 	~INIFile();
 
+	bool SaveCache(const std::wstring &cachePath);
+
+
+	// Precomputed lookup for a key that is read repeatedly.
+	struct key_handle
+	{
+		size_t Hash;
+		std::wstring Section;
+		std::wstring Key;
+	};
+	static key_handle GetHandle(std::wstring_view section, std::wstring_view key);
+
+	long long GetInt(std::wstring_view section, std::wstring_view key, long long def);
+	long long GetInt(const key_handle &handle, long long def);
+
+	unsigned long long GetUInt(std::wstring_view section, std::wstring_view key, unsigned long long def);
+	unsigned long long GetUInt(const key_handle &handle, unsigned long long def);
+
+	double GetFloat(std::wstring_view section, std::wstring_view key, double def);
+	double GetFloat(const key_handle &handle, double def);
 
-	long long GetInt(std::wstring &section, std::wstring &key, long long def);
-	long long GetInt(std::wstring &section, std::wstring key, long long def);
-	long long GetInt(std::wstring section, std::wstring &key, long long def);
-	long long GetInt(std::wstring section, std::wstring key, long long def);
+	std::wstring GetString(std::wstring_view section, std::wstring_view key);
+	std::wstring GetString(const key_handle &handle);
 
-	unsigned long long GetUInt(std::wstring &section, std::wstring &key, unsigned long long def);
-	unsigned long long GetUInt(std::wstring &section, std::wstring key, unsigned long long def);
-	unsigned long long GetUInt(std::wstring section, std::wstring &key, unsigned long long def);
-	unsigned long long GetUInt(std::wstring section, std::wstring key, unsigned long long def);
+	INIKey *GetKey(std::wstring_view section, std::wstring_view key);
+	INIKey *GetKey(const key_handle &handle);
 
-	double GetFloat(std::wstring &section, std::wstring &key, double def);
-	double GetFloat(std::wstring &section, std::wstring key, double def);
-	double GetFloat(std::wstring section, std::wstring &key, double def);
-	double GetFloat(std::wstring section, std::wstring key, double def);
+	// Change a key's value, adding the key and its section if they do not exist yet.
+	INIKey *SetValue(std::wstring_view section, std::wstring_view key, std::wstring_view value);
 
-	std::wstring GetString(std::wstring &section, std::wstring &key);
-	std::wstring GetString(std::wstring &section, std::wstring key);
-	std::wstring GetString(std::wstring section, std::wstring &key);
-	std::wstring GetString(std::wstring section, std::wstring key);
+	const std::wstring &GetPath();
+	size_t GetSectionCount();
+	INISection *GetSection(size_t index);
+	INISection *GetSection(std::wstring_view name);
 
 private:
+	friend class INIConfig;
+
+	// Open-addressed index over every (section, key) pair, built once the file is loaded.
+	struct key_index_entry
+	{
+		size_t Hash;
+		INISection *Section;
+		INIKey *Key;
+	};
+
+	std::wstring SourcePath;
 	std::vector<std::unique_ptr<INISection>> Sections;
+	std::vector<key_index_entry> KeyIndex;
 
-	long long _GetInt(std::wstring &section, std::wstring &key, long long def);
-	unsigned long long _GetUInt(std::wstring &section, std::wstring &key, unsigned long long def);
-	double _GetFloat(std::wstring &section, std::wstring &key, double def);
-	std::wstring _GetString(std::wstring &section, std::wstring &key);
+	static size_t _Hash(std::wstring_view section, std::wstring_view key);
+	INIKey *_Find(size_t hash, std::wstring_view section, std::wstring_view key);
+	void _BuildIndex();
 	void _Initialize(std::wstring &path);
+
+	// Binary cache layout: cache_header, sections, keys, then the string pool.
+	struct cache_header
+	{
+		unsigned Magic;
+		unsigned Version;
+		unsigned CharSize;
+		unsigned SectionCount;
+		unsigned KeyCount;
+		unsigned PoolLength;
+		unsigned long long SourceSize;
+		long long SourceTime;
+	};
+
+	struct cache_section
+	{
+		unsigned Name;
+		unsigned NameLength;
+		unsigned KeyCount;
+	};
+
+	struct cache_key
+	{
+		unsigned Name;
+		unsigned NameLength;
+		unsigned Value;
+		unsigned ValueLength;
+		unsigned Valid;
+		long long IntValue;
+		unsigned long long UIntValue;
+		double FloatValue;
+	};
+
+	static bool _GetSourceStamp(const std::wstring &path, unsigned long long &size, long long &time);
+	bool _LoadCache(const std::wstring &path, const std::wstring &cachePath);
 };
 }
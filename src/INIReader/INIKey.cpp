@@ -1,4 +1,7 @@
 #include "INIKey.h"
+#include <cerrno>
+#include <cwchar>
+#include <cwctype>
 
 namespace TChapman500 {
 INIKey::INIKey(std::wstring &line)
@@ -18,11 +21,64 @@ INIKey::INIKey(std::wstring &line)
 
 	Value = preComment.substr(pos + 1);
 	Value.erase(0, Value.find_first_not_of(whitespace));
+	_Parse();
 }
 
+INIKey::INIKey() {}
 INIKey::~INIKey() {}
-void INIKey::SetValue(std::wstring value) { Value = value; }
-void INIKey::SetValue(std::wstring &value) { Value = value; }
-std::wstring INIKey::GetName() { return Key; }
-std::wstring INIKey::GetValue() { return Value; }
+void INIKey::SetValue(std::wstring value) { Value = value; _Parse(); }
+void INIKey::SetValue(std::wstring &value) { Value = value; _Parse(); }
+const std::wstring &INIKey::GetName() { return Key; }
+const std::wstring &INIKey::GetValue() { return Value; }
+
+long long INIKey::GetInt() { return IntValue; }
+unsigned long long INIKey::GetUInt() { return UIntValue; }
+double INIKey::GetFloat() { return FloatValue; }
+
+bool INIKey::TryGetInt(long long &value)
+{
+	if (!(Valid & IntValid)) return false;
+	value = IntValue;
+	return true;
+}
+
+bool INIKey::TryGetUInt(unsigned long long &value)
+{
+	if (!(Valid & UIntValid)) return false;
+	value = UIntValue;
+	return true;
+}
+
+bool INIKey::TryGetFloat(double &value)
+{
+	if (!(Valid & FloatValid)) return false;
+	value = FloatValue;
+	return true;
+}
+
+// Whether an integer is written with a leading zero, which base 0 would read as octal.
+static bool IsOctal(const std::wstring &value)
+{
+	size_t digit = value.find_first_not_of(L" \t\n\r\f\v+-");
+	return digit != std::wstring::npos && digit + 1 < value.size() && value[digit] == L'0' && iswdigit(value[digit + 1]);
+}
+
+void INIKey::_Parse()
+{
+	Valid = 0;
+	wchar_t *end = nullptr;
+	bool octal = IsOctal(Value);
+
+	errno = 0;
+	IntValue = wcstoll(Value.c_str(), &end, 0);
+	if (!Value.empty() && *end == L'\0' && errno != ERANGE && !octal) Valid |= IntValid;
+
+	errno = 0;
+	UIntValue = wcstoull(Value.c_str(), &end, 0);
+	if (!Value.empty() && *end == L'\0' && errno != ERANGE && !octal && Value[0] != L'-') Valid |= UIntValid;
+
+	errno = 0;
+	FloatValue = wcstod(Value.c_str(), &end);
+	if (!Value.empty() && *end == L'\0' && errno != ERANGE) Valid |= FloatValid;
+}
 }
\ No newline at end of file
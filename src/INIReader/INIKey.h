@@ -12,11 +12,40 @@ public:
 
 	void SetValue(std::wstring value);
 	void SetValue(std::wstring &value);
-	std::wstring GetName();
-	std::wstring GetValue();
+	const std::wstring &GetName();
+	const std::wstring &GetValue();
+
+	// Typed values are parsed whenever the value is set, so many threads can read the same key
+	// at once.  Integers may be decimal, hex with 0x, or octal with a leading 0.
+	long long GetInt();
+	unsigned long long GetUInt();
+	double GetFloat();
+
+	// Same as above, but fail if the value is not entirely a number or is out of range.  Integers
+	// with a leading 0 also fail, since "010" would read as eight.
+	bool TryGetInt(long long &value);
+	bool TryGetUInt(unsigned long long &value);
+	bool TryGetFloat(double &value);
 
 private:
+	friend class INIFile;
+	INIKey();
+
+	enum valid_flags : unsigned char
+	{
+		IntValid = 1,
+		UIntValid = 2,
+		FloatValid = 4
+	};
+
 	std::wstring Key;
 	std::wstring Value;
+
+	unsigned char Valid = 0;
+	long long IntValue = 0;
+	unsigned long long UIntValue = 0;
+	double FloatValue = 0.0;
+
+	void _Parse();
 };
 }
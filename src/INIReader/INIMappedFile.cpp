@@ -0,0 +1,343 @@
+#include "INIMappedFile.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define TC500_INI_SSE2
+#include <immintrin.h>
+#endif
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <filesystem>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace TChapman500 {
+static inline bool IsWhitespace(char c) { return c == ' ' || c == '\t' || c == '\r' || c == '\n' || c == '\f' || c == '\v'; }
+
+static inline unsigned LowestBit(unsigned mask)
+{
+#ifdef _MSC_VER
+	unsigned long index;
+	_BitScanForward(&index, mask);
+	return (unsigned)index;
+#else
+	return (unsigned)__builtin_ctz(mask);
+#endif
+}
+
+static inline bool IsStructural(char c) { return c == '\n' || c == '=' || c == ';' || c == '[' || c == ']'; }
+
+// Offsets of every newline, '=', ';', '[' and ']' in a block, found 32 or 16 bytes at a time,
+// followed by the size of the block.  tokens must have room for size + 1 offsets, the worst
+// case, so the vector loops can write without checking.  Returns the number written.
+static size_t FindStructure(const char *data, size_t size, uint32_t *tokens)
+{
+	uint32_t *out = tokens;
+	size_t i = 0;
+#ifdef __AVX2__
+	const __m256i newline32 = _mm256_set1_epi8('\n');
+	const __m256i equals32 = _mm256_set1_epi8('=');
+	const __m256i comment32 = _mm256_set1_epi8(';');
+	const __m256i open32 = _mm256_set1_epi8('[');
+	const __m256i close32 = _mm256_set1_epi8(']');
+	for (; i + 32 <= size; i += 32)
+	{
+		__m256i bytes = _mm256_loadu_si256((const __m256i *)(data + i));
+		__m256i found = _mm256_or_si256(_mm256_cmpeq_epi8(bytes, newline32), _mm256_cmpeq_epi8(bytes, equals32));
+		found = _mm256_or_si256(found, _mm256_cmpeq_epi8(bytes, comment32));
+		found = _mm256_or_si256(found, _mm256_or_si256(_mm256_cmpeq_epi8(bytes, open32), _mm256_cmpeq_epi8(bytes, close32)));
+		for (unsigned mask = (unsigned)_mm256_movemask_epi8(found); mask; mask &= mask - 1)
+			*out++ = (uint32_t)(i + LowestBit(mask));
+	}
+#endif
+#ifdef TC500_INI_SSE2
+	const __m128i newline = _mm_set1_epi8('\n');
+	const __m128i equals = _mm_set1_epi8('=');
+	const __m128i comment = _mm_set1_epi8(';');
+	const __m128i open = _mm_set1_epi8('[');
+	const __m128i close = _mm_set1_epi8(']');
+	for (; i + 16 <= size; i += 16)
+	{
+		__m128i bytes = _mm_loadu_si128((const __m128i *)(data + i));
+		__m128i found = _mm_or_si128(_mm_cmpeq_epi8(bytes, newline), _mm_cmpeq_epi8(bytes, equals));
+		found = _mm_or_si128(found, _mm_cmpeq_epi8(bytes, comment));
+		found = _mm_or_si128(found, _mm_or_si128(_mm_cmpeq_epi8(bytes, open), _mm_cmpeq_epi8(bytes, close)));
+		for (unsigned mask = (unsigned)_mm_movemask_epi8(found); mask; mask &= mask - 1)
+			*out++ = (uint32_t)(i + LowestBit(mask));
+	}
+#endif
+	for (; i < size; i++)
+	{
+		if (IsStructural(data[i])) *out++ = (uint32_t)i;
+	}
+
+	// End of block
+	*out++ = (uint32_t)size;
+	return (size_t)(out - tokens);
+}
+
+// Numbers are short, so copy them into a terminated buffer for the C conversion functions.
+template<typename T, typename F> static inline T ConvertNumber(std::string_view value, F convert)
+{
+	char buffer[64];
+	if (value.size() < sizeof(buffer))
+	{
+		memcpy(buffer, value.data(), value.size());
+		buffer[value.size()] = '\0';
+		return convert(buffer);
+	}
+	return convert(std::string(value).c_str());
+}
+
+INIMappedFile::INIMappedFile(const std::wstring &path)
+{
+	Data = nullptr;
+	Size = 0;
+	_Map(path);
+	if (Data) _Parse();
+}
+
+INIMappedFile::~INIMappedFile()
+{
+#ifdef _WIN32
+	if (Data) UnmapViewOfFile(Data);
+	if (Mapping) CloseHandle(Mapping);
+	if (File != INVALID_HANDLE_VALUE) CloseHandle(File);
+#else
+	if (Data) munmap((void *)Data, Size);
+#endif
+}
+
+bool INIMappedFile::IsOpen() { return Data != nullptr; }
+
+long long INIMappedFile::GetInt(std::string_view section, std::string_view key, long long def)
+{
+	const key_entry *entry = _FindKey(section, key);
+	if (!entry) return def;
+	return ConvertNumber<long long>(_View(entry->Value), [](const char *str) { return strtoll(str, nullptr, 0); });
+}
+
+unsigned long long INIMappedFile::GetUInt(std::string_view section, std::string_view key, unsigned long long def)
+{
+	const key_entry *entry = _FindKey(section, key);
+	if (!entry) return def;
+	return ConvertNumber<unsigned long long>(_View(entry->Value), [](const char *str) { return strtoull(str, nullptr, 0); });
+}
+
+double INIMappedFile::GetFloat(std::string_view section, std::string_view key, double def)
+{
+	const key_entry *entry = _FindKey(section, key);
+	if (!entry) return def;
+	return ConvertNumber<double>(_View(entry->Value), [](const char *str) { return strtod(str, nullptr); });
+}
+
+std::string_view INIMappedFile::GetString(std::string_view section, std::string_view key)
+{
+	const key_entry *entry = _FindKey(section, key);
+	if (!entry) return std::string_view();
+	return _View(entry->Value);
+}
+
+size_t INIMappedFile::GetSectionCount() { return Sections.size(); }
+
+std::string_view INIMappedFile::GetSectionName(size_t section)
+{
+	if (section >= Sections.size()) return std::string_view();
+	return _View(Sections[section].Name);
+}
+
+size_t INIMappedFile::GetKeyCount(size_t section)
+{
+	if (section >= Sections.size()) return 0;
+	return Sections[section].KeyCount;
+}
+
+std::string_view INIMappedFile::GetKeyName(size_t section, size_t key)
+{
+	if (section >= Sections.size() || key >= Sections[section].KeyCount) return std::string_view();
+	return _View(Keys[Sections[section].FirstKey + key].Name);
+}
+
+std::string_view INIMappedFile::GetKeyValue(size_t section, size_t key)
+{
+	if (section >= Sections.size() || key >= Sections[section].KeyCount) return std::string_view();
+	return _View(Keys[Sections[section].FirstKey + key].Value);
+}
+
+const INIMappedFile::key_entry *INIMappedFile::_FindKey(std::string_view section, std::string_view key)
+{
+	for (size_t i = 0; i < Sections.size(); i++)
+	{
+		if (_View(Sections[i].Name) != section) continue;
+
+		// Later keys replace earlier ones with the same name.
+		const key_entry *keys = Keys.data() + Sections[i].FirstKey;
+		for (size_t j = Sections[i].KeyCount; j > 0; j--)
+		{
+			if (_View(keys[j - 1].Name) == key)
+				return &keys[j - 1];
+		}
+		return nullptr;
+	}
+	return nullptr;
+}
+
+void INIMappedFile::_Map(const std::wstring &path)
+{
+#ifdef _WIN32
+	Mapping = nullptr;
+	File = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (File == INVALID_HANDLE_VALUE) return;
+
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx(File, &fileSize) || fileSize.QuadPart == 0) return;
+
+	Mapping = CreateFileMappingW(File, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (!Mapping) return;
+
+	Data = (const char *)MapViewOfFile(Mapping, FILE_MAP_READ, 0, 0, 0);
+	if (Data) Size = (size_t)fileSize.QuadPart;
+#else
+	int file = open(std::filesystem::path(path).c_str(), O_RDONLY);
+	if (file < 0) return;
+
+	struct stat status;
+	if (fstat(file, &status) == 0 && status.st_size > 0)
+	{
+		void *mapping = mmap(nullptr, (size_t)status.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+		if (mapping != MAP_FAILED)
+		{
+			madvise(mapping, (size_t)status.st_size, MADV_SEQUENTIAL);
+			Data = (const char *)mapping;
+			Size = (size_t)status.st_size;
+		}
+	}
+	close(file);
+#endif
+}
+
+void INIMappedFile::_Parse()
+{
+	// The file is tokenized in blocks small enough for the token table to stay in cache.
+	const size_t blockSize = 64 * 1024;
+	size_t begin = 0;
+
+	// Skip the UTF-8 byte order mark
+	if (Size >= 3 && memcmp(Data, "\xEF\xBB\xBF", 3) == 0) begin = 3;
+
+	auto trim = [this](size_t first, size_t last) -> text_range {
+		while (first < last && IsWhitespace(Data[first])) first++;
+		while (last > first && IsWhitespace(Data[last - 1])) last--;
+		text_range result;
+		result.Offset = first;
+		result.Length = last - first;
+		return result;
+	};
+
+	std::vector<uint32_t> tokens;
+	for (size_t block = begin; block < Size; )
+	{
+		// End the block after its last newline so that no line is split.
+		size_t blockEnd = Size;
+		if (Size - block > blockSize)
+		{
+			blockEnd = block + blockSize;
+			while (blockEnd > block && Data[blockEnd - 1] != '\n') blockEnd--;
+
+			// A single line longer than a block.
+			if (blockEnd == block)
+			{
+				const char *newline = (const char *)memchr(Data + block + blockSize, '\n', Size - block - blockSize);
+				blockEnd = newline ? (size_t)(newline - Data) + 1 : Size;
+			}
+		}
+
+		// Find every structural character first, then only look at those.  The table only ever
+		// grows, so it is not cleared again for every block.
+		if (tokens.size() < blockEnd - block + 1) tokens.resize(blockEnd - block + 1);
+		FindStructure(Data + block, blockEnd - block, tokens.data());
+		const uint32_t *token = tokens.data();
+
+		for (size_t line = block; line < blockEnd; )
+		{
+			// Find the first of each character on this line.
+			size_t equals = 0;
+			size_t comment = 0;
+			size_t close = 0;
+			size_t lineEnd;
+			for (; ; token++)
+			{
+				size_t offset = block + *token;
+				if (offset == blockEnd || Data[offset] == '\n')
+				{
+					lineEnd = offset;
+					token++;
+					break;
+				}
+
+				char c = Data[offset];
+				if (c == ';' && !comment) comment = offset;
+				else if (c == '=' && !equals) equals = offset;
+				else if (c == ']' && !close) close = offset;
+			}
+			size_t next = lineEnd + 1;
+
+			// Remove leading whitespace
+			while (line < lineEnd && IsWhitespace(Data[line])) line++;
+
+			// Line is empty or contains only a comment
+			if (line == lineEnd || Data[line] == ';')
+			{
+				line = next;
+				continue;
+			}
+
+			// Everything after a comment is ignored
+			if (comment) lineEnd = comment;
+
+			// Create a new section
+			if (Data[line] == '[')
+			{
+				section_entry section;
+				section.Name = trim(line + 1, close && close < lineEnd ? close : lineEnd);
+				section.FirstKey = Keys.size();
+				section.KeyCount = 0;
+				Sections.push_back(section);
+				line = next;
+				continue;
+			}
+
+			// We are not yet in a section
+			if (Sections.empty())
+			{
+				line = next;
+				continue;
+			}
+
+			// Add the new key
+			if (equals && equals < lineEnd)
+			{
+				key_entry key;
+				key.Name = trim(line, equals);
+				key.Value = trim(equals + 1, lineEnd);
+				if (key.Name.Length)
+				{
+					Keys.push_back(key);
+					Sections.back().KeyCount++;
+				}
+			}
+			line = next;
+		}
+
+		block = blockEnd;
+	}
+}
+}
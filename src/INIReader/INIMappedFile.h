@@ -0,0 +1,67 @@
+#pragma once
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace TChapman500 {
+// Read-only view of a UTF-8 INI file.  The file is memory-mapped and scanned once; sections and
+// keys are stored as offsets into the mapping, so the returned views stay valid for as long as
+// the object lives and no lookup allocates.  Parsing follows the same rules as INIFile.
+class INIMappedFile
+{
+public:
+	INIMappedFile(const std::wstring &path);
+	~INIMappedFile();
+
+	INIMappedFile(const INIMappedFile &) = delete;
+	INIMappedFile &operator=(const INIMappedFile &) = delete;
+
+	bool IsOpen();
+
+	long long GetInt(std::string_view section, std::string_view key, long long def);
+	unsigned long long GetUInt(std::string_view section, std::string_view key, unsigned long long def);
+	double GetFloat(std::string_view section, std::string_view key, double def);
+	std::string_view GetString(std::string_view section, std::string_view key);
+
+	size_t GetSectionCount();
+	std::string_view GetSectionName(size_t section);
+	size_t GetKeyCount(size_t section);
+	std::string_view GetKeyName(size_t section, size_t key);
+	std::string_view GetKeyValue(size_t section, size_t key);
+
+private:
+	struct text_range
+	{
+		size_t Offset;
+		size_t Length;
+	};
+
+	struct section_entry
+	{
+		text_range Name;
+		size_t FirstKey;
+		size_t KeyCount;
+	};
+
+	struct key_entry
+	{
+		text_range Name;
+		text_range Value;
+	};
+
+	const char *Data;
+	size_t Size;
+#ifdef _WIN32
+	void *File;
+	void *Mapping;
+#endif
+
+	std::vector<section_entry> Sections;
+	std::vector<key_entry> Keys;
+
+	inline std::string_view _View(const text_range &range) { return std::string_view(Data + range.Offset, range.Length); }
+	const key_entry *_FindKey(std::string_view section, std::string_view key);
+	void _Map(const std::wstring &path);
+	void _Parse();
+};
+}
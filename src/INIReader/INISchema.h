@@ -0,0 +1,148 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <functional>
+#include <climits>
+#include <cwctype>
+#include "INIFile.h"
+#include "INIKey.h"
+
+namespace TChapman500 {
+// Binds (section, key) pairs of an INI file to the fields of a settings struct.  Apply() reads
+// and validates every bound key in one pass, so the struct can be read directly afterwards.
+// Keys that are missing or are not valid numbers get their default, and each problem is
+// reported in the error list.
+template<typename T> class INISchema
+{
+public:
+	INISchema &Bind(std::wstring section, std::wstring key, long long T:: *field, long long def, bool required = false)
+	{
+		return _Bind(section, key, required, [field, def](T &target) { target.*field = def; },
+			[field](INIKey *iKey, T &target) { return iKey->TryGetInt(target.*field); });
+	}
+
+	INISchema &Bind(std::wstring section, std::wstring key, int T:: *field, int def, bool required = false)
+	{
+		return _Bind(section, key, required, [field, def](T &target) { target.*field = def; },
+			[field](INIKey *iKey, T &target) {
+				long long value;
+				if (!iKey->TryGetInt(value) || value < INT_MIN || value > INT_MAX) return false;
+				target.*field = (int)value;
+				return true;
+			});
+	}
+
+	INISchema &Bind(std::wstring section, std::wstring key, unsigned long long T:: *field, unsigned long long def, bool required = false)
+	{
+		return _Bind(section, key, required, [field, def](T &target) { target.*field = def; },
+			[field](INIKey *iKey, T &target) { return iKey->TryGetUInt(target.*field); });
+	}
+
+	INISchema &Bind(std::wstring section, std::wstring key, unsigned T:: *field, unsigned def, bool required = false)
+	{
+		return _Bind(section, key, required, [field, def](T &target) { target.*field = def; },
+			[field](INIKey *iKey, T &target) {
+				unsigned long long value;
+				if (!iKey->TryGetUInt(value) || value > UINT_MAX) return false;
+				target.*field = (unsigned)value;
+				return true;
+			});
+	}
+
+	INISchema &Bind(std::wstring section, std::wstring key, double T:: *field, double def, bool required = false)
+	{
+		return _Bind(section, key, required, [field, def](T &target) { target.*field = def; },
+			[field](INIKey *iKey, T &target) { return iKey->TryGetFloat(target.*field); });
+	}
+
+	INISchema &Bind(std::wstring section, std::wstring key, float T:: *field, float def, bool required = false)
+	{
+		return _Bind(section, key, required, [field, def](T &target) { target.*field = def; },
+			[field](INIKey *iKey, T &target) {
+				double value;
+				if (!iKey->TryGetFloat(value)) return false;
+				target.*field = (float)value;
+				return true;
+			});
+	}
+
+	// Accepts 1/0, true/false, yes/no and on/off.
+	INISchema &Bind(std::wstring section, std::wstring key, bool T:: *field, bool def, bool required = false)
+	{
+		return _Bind(section, key, required, [field, def](T &target) { target.*field = def; },
+			[field](INIKey *iKey, T &target) {
+				const std::wstring &value = iKey->GetValue();
+				if (value == L"1" || _Equals(value, L"true") || _Equals(value, L"yes") || _Equals(value, L"on")) target.*field = true;
+				else if (value == L"0" || _Equals(value, L"false") || _Equals(value, L"no") || _Equals(value, L"off")) target.*field = false;
+				else return false;
+				return true;
+			});
+	}
+
+	INISchema &Bind(std::wstring section, std::wstring key, std::wstring T:: *field, std::wstring def, bool required = false)
+	{
+		return _Bind(section, key, required, [field, def](T &target) { target.*field = def; },
+			[field](INIKey *iKey, T &target) { target.*field = iKey->GetValue(); return true; });
+	}
+
+	// Returns false if anything was reported.
+	bool Apply(INIFile &file, T &target, std::vector<std::wstring> *errors = nullptr)
+	{
+		bool result = true;
+		for (const binding &bound : Bindings)
+		{
+			INIKey *iKey = file.GetKey(bound.Handle);
+			if (!iKey)
+			{
+				bound.SetDefault(target);
+				if (!bound.Required) continue;
+
+				result = false;
+				if (errors) errors->push_back(L"[" + bound.Handle.Section + L"] " + bound.Handle.Key + L": missing");
+				continue;
+			}
+
+			if (!bound.Read(iKey, target))
+			{
+				bound.SetDefault(target);
+				result = false;
+				if (errors) errors->push_back(L"[" + bound.Handle.Section + L"] " + bound.Handle.Key + L": invalid value \"" + iKey->GetValue() + L"\"");
+			}
+		}
+		return result;
+	}
+
+private:
+	struct binding
+	{
+		INIFile::key_handle Handle;
+		bool Required;
+		std::function<void(T &)> SetDefault;
+		std::function<bool(INIKey *, T &)> Read;
+	};
+
+	std::vector<binding> Bindings;
+
+	INISchema &_Bind(std::wstring &section, std::wstring &key, bool required, std::function<void(T &)> setDefault, std::function<bool(INIKey *, T &)> read)
+	{
+		binding newBinding;
+		newBinding.Handle = INIFile::GetHandle(section, key);
+		newBinding.Required = required;
+		newBinding.SetDefault = setDefault;
+		newBinding.Read = read;
+		Bindings.push_back(newBinding);
+		return *this;
+	}
+
+	// Case-insensitive compare against a lowercase word.
+	static bool _Equals(const std::wstring &value, const wchar_t *word)
+	{
+		size_t i = 0;
+		for (; i < value.size(); i++)
+		{
+			if (word[i] == L'\0' || (wchar_t)towlower((wint_t)value[i]) != word[i]) return false;
+		}
+		return word[i] == L'\0';
+	}
+};
+}
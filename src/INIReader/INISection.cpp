@@ -12,9 +12,10 @@ INISection::INISection(std::wstring &line)
 	Name.erase(Name.find_last_not_of(whitespace) + 1);
 }
 
+INISection::INISection() {}
 INISection::~INISection() {}
 
-std::wstring INISection::GetName() { return Name; }
+const std::wstring &INISection::GetName() { return Name; }
 
 bool INISection::AddKey(std::unique_ptr<INIKey> &newKey)
 {
@@ -32,43 +33,49 @@ bool INISection::AddKey(std::unique_ptr<INIKey> &newKey)
 	return true;
 }
 
-long long INISection::GetInt(std::wstring &key, long long def)
+INIKey *INISection::GetKey(std::wstring_view key)
 {
 	for (size_t i = 0; i < Keys.size(); i++)
 	{
 		if (Keys[i]->GetName() == key)
-			return wcstoll(Keys[i]->GetValue().c_str(), nullptr, 0);
+			return Keys[i].get();
 	}
-	return def;
+	return nullptr;
 }
 
-unsigned long long INISection::GetUInt(std::wstring &key, unsigned long long def)
+size_t INISection::GetKeyCount() { return Keys.size(); }
+
+INIKey *INISection::GetKey(size_t index)
 {
-	for (size_t i = 0; i < Keys.size(); i++)
-	{
-		if (Keys[i]->GetName() == key)
-			return wcstoull(Keys[i]->GetValue().c_str(), nullptr, 0);
-	}
-	return def;
+	if (index >= Keys.size()) return nullptr;
+	return Keys[index].get();
 }
 
-double INISection::GetFloat(std::wstring &key, double def)
+long long INISection::GetInt(std::wstring_view key, long long def)
 {
-	for (size_t i = 0; i < Keys.size(); i++)
-	{
-		if (Keys[i]->GetName() == key)
-			return wcstod(Keys[i]->GetValue().c_str(), nullptr);
-	}
-	return def;
+	INIKey *iKey = GetKey(key);
+	if (!iKey) return def;
+	return iKey->GetInt();
 }
 
-std::wstring INISection::GetString(std::wstring &key)
+unsigned long long INISection::GetUInt(std::wstring_view key, unsigned long long def)
 {
-	for (size_t i = 0; i < Keys.size(); i++)
-	{
-		if (Keys[i]->GetName() == key)
-			return Keys[i]->GetValue();
-	}
-	return std::wstring();
+	INIKey *iKey = GetKey(key);
+	if (!iKey) return def;
+	return iKey->GetUInt();
+}
+
+double INISection::GetFloat(std::wstring_view key, double def)
+{
+	INIKey *iKey = GetKey(key);
+	if (!iKey) return def;
+	return iKey->GetFloat();
+}
+
+std::wstring INISection::GetString(std::wstring_view key)
+{
+	INIKey *iKey = GetKey(key);
+	if (!iKey) return std::wstring();
+	return iKey->GetValue();
 }
 }
\ No newline at end of file
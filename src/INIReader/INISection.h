@@ -1,5 +1,6 @@
 #pragma once
 #include <string>
+#include <string_view>
 #include <memory>
 #include <vector>
 
@@ -11,17 +12,24 @@ public:
 	INISection(std::wstring &line);
 	~INISection();
 
-	std::wstring GetName();
+	const std::wstring &GetName();
 
 	bool AddKey(std::unique_ptr<INIKey> &newKey);
 
-	long long GetInt(std::wstring &key, long long def);
-	unsigned long long GetUInt(std::wstring &key, unsigned long long def);
-	double GetFloat(std::wstring &key, double def);
-	std::wstring GetString(std::wstring &key);
+	INIKey *GetKey(std::wstring_view key);
+	size_t GetKeyCount();
+	INIKey *GetKey(size_t index);
+
+	long long GetInt(std::wstring_view key, long long def);
+	unsigned long long GetUInt(std::wstring_view key, unsigned long long def);
+	double GetFloat(std::wstring_view key, double def);
+	std::wstring GetString(std::wstring_view key);
 
 
 private:
+	friend class INIFile;
+	INISection();
+
 	std::wstring Name;
 	std::vector<std::unique_ptr<INIKey>> Keys;
 };
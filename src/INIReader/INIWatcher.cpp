@@ -0,0 +1,278 @@
+#include "INIWatcher.h"
+#include <filesystem>
+#include <unordered_set>
+
+#include "INIFile.h"
+#include "INISection.h"
+#include "INIKey.h"
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <sys/inotify.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace TChapman500 {
+INIWatcher::INIWatcher(const std::wstring &path)
+{
+	Path = path;
+	NextID = 1;
+	Running = false;
+#ifdef _WIN32
+	StopEvent = nullptr;
+#else
+	StopPipe[0] = -1;
+	StopPipe[1] = -1;
+#endif
+
+	if (!_GetStamp(SourceSize, SourceTime))
+	{
+		SourceSize = 0;
+		SourceTime = 0;
+	}
+	File = std::make_shared<INIFile>(std::wstring(Path));
+}
+
+INIWatcher::~INIWatcher() { Stop(); }
+
+std::shared_ptr<INIFile> INIWatcher::GetFile()
+{
+	std::lock_guard<std::mutex> lock(Lock);
+	return File;
+}
+
+size_t INIWatcher::Subscribe(callback function, std::wstring_view section, std::wstring_view key)
+{
+	std::lock_guard<std::mutex> lock(Lock);
+	subscriber newSubscriber;
+	newSubscriber.ID = NextID++;
+	newSubscriber.Section = section;
+	newSubscriber.Key = key;
+	newSubscriber.Function = function;
+	Subscribers.push_back(newSubscriber);
+	return newSubscriber.ID;
+}
+
+void INIWatcher::Unsubscribe(size_t id)
+{
+	std::lock_guard<std::mutex> lock(Lock);
+	for (size_t i = 0; i < Subscribers.size(); i++)
+	{
+		if (Subscribers[i].ID == id)
+		{
+			Subscribers.erase(Subscribers.begin() + i);
+			return;
+		}
+	}
+}
+
+bool INIWatcher::Start()
+{
+	if (Running) return true;
+
+#ifdef _WIN32
+	StopEvent = CreateEventW(nullptr, TRUE, FALSE, nullptr);
+	if (!StopEvent) return false;
+#else
+	if (pipe(StopPipe) != 0) return false;
+#endif
+
+	Running = true;
+	Thread = std::thread(&INIWatcher::_Watch, this);
+	return true;
+}
+
+void INIWatcher::Stop()
+{
+	if (!Running) return;
+	Running = false;
+
+#ifdef _WIN32
+	SetEvent(StopEvent);
+	Thread.join();
+	CloseHandle(StopEvent);
+	StopEvent = nullptr;
+#else
+	char wake = 0;
+	if (write(StopPipe[1], &wake, 1) != 1) {}
+	Thread.join();
+	close(StopPipe[0]);
+	close(StopPipe[1]);
+	StopPipe[0] = -1;
+	StopPipe[1] = -1;
+#endif
+}
+
+bool INIWatcher::Poll()
+{
+	// Only one reload at a time, so the stamps and the diff always agree.
+	std::lock_guard<std::mutex> pollLock(PollLock);
+
+	unsigned long long size;
+	long long time;
+	if (!_GetStamp(size, time)) return false;
+	if (size == SourceSize && time == SourceTime) return false;
+
+	std::shared_ptr<INIFile> newFile = std::make_shared<INIFile>(std::wstring(Path));
+	std::shared_ptr<INIFile> oldFile = GetFile();
+	std::vector<key_change> changes = Diff(*oldFile, *newFile);
+
+	SourceSize = size;
+	SourceTime = time;
+	{
+		std::lock_guard<std::mutex> lock(Lock);
+		File = newFile;
+	}
+
+	if (!changes.empty()) _Notify(changes);
+	return true;
+}
+
+std::vector<INIWatcher::key_change> INIWatcher::Diff(INIFile &oldFile, INIFile &newFile)
+{
+	std::vector<key_change> changes;
+
+	// Compares every key that a lookup can reach in one file against the other file.  Only the
+	// first section with a given name is ever looked at.
+	auto compare = [&changes](INIFile &from, INIFile &to, bool added) {
+		std::unordered_set<std::wstring_view> seen;
+		for (size_t i = 0; i < from.GetSectionCount(); i++)
+		{
+			INISection *section = from.GetSection(i);
+			if (!seen.insert(section->GetName()).second) continue;
+
+			for (size_t k = 0; k < section->GetKeyCount(); k++)
+			{
+				INIKey *key = section->GetKey(k);
+				INIKey *other = to.GetKey(section->GetName(), key->GetName());
+				if (other && (!added || other->GetValue() == key->GetValue())) continue;
+
+				key_change change;
+				change.Section = section->GetName();
+				change.Key = key->GetName();
+				if (!added)
+				{
+					change.Type = change_type::Removed;
+					change.OldValue = key->GetValue();
+				}
+				else if (!other) change.Type = change_type::Added;
+				else
+				{
+					change.Type = change_type::Changed;
+					change.OldValue = other->GetValue();
+				}
+				if (added) change.NewValue = key->GetValue();
+				changes.push_back(change);
+			}
+		}
+	};
+
+	compare(newFile, oldFile, true);
+	compare(oldFile, newFile, false);
+	return changes;
+}
+
+bool INIWatcher::_GetStamp(unsigned long long &size, long long &time)
+{
+	std::error_code error;
+	std::filesystem::path sourcePath(Path);
+	size = (unsigned long long)std::filesystem::file_size(sourcePath, error);
+	if (error) return false;
+	time = (long long)std::filesystem::last_write_time(sourcePath, error).time_since_epoch().count();
+	return !error;
+}
+
+void INIWatcher::_Notify(const std::vector<key_change> &changes)
+{
+	// Call subscribers without holding the lock, so they may subscribe or read the file.
+	std::vector<subscriber> subscribers;
+	{
+		std::lock_guard<std::mutex> lock(Lock);
+		subscribers = Subscribers;
+	}
+
+	std::vector<key_change> matching;
+	for (const subscriber &entry : subscribers)
+	{
+		if (entry.Section.empty() && entry.Key.empty())
+		{
+			entry.Function(changes);
+			continue;
+		}
+
+		matching.clear();
+		for (const key_change &change : changes)
+		{
+			if (!entry.Section.empty() && entry.Section != change.Section) continue;
+			if (!entry.Key.empty() && entry.Key != change.Key) continue;
+			matching.push_back(change);
+		}
+		if (!matching.empty()) entry.Function(matching);
+	}
+}
+
+void INIWatcher::_Watch()
+{
+	// Editors often save by writing a new file and renaming it over the old one, so the
+	// directory is watched rather than the file itself.
+	std::filesystem::path sourcePath(Path);
+	std::filesystem::path directory = sourcePath.parent_path();
+	if (directory.empty()) directory = std::filesystem::current_path();
+
+#ifdef _WIN32
+	HANDLE change = FindFirstChangeNotificationW(directory.c_str(), FALSE, FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_SIZE | FILE_NOTIFY_CHANGE_LAST_WRITE);
+	if (change == INVALID_HANDLE_VALUE) return;
+
+	HANDLE handles[2] = { change, (HANDLE)StopEvent };
+	while (Running)
+	{
+		DWORD result = WaitForMultipleObjects(2, handles, FALSE, INFINITE);
+		if (result != WAIT_OBJECT_0) break;
+
+		// The notification does not say which file changed, so let Poll() compare stamps.
+		Sleep(50);
+		if (!FindNextChangeNotification(change)) break;
+		Poll();
+	}
+	FindCloseChangeNotification(change);
+#else
+	int notify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (notify < 0) return;
+	if (inotify_add_watch(notify, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE) < 0)
+	{
+		close(notify);
+		return;
+	}
+
+	std::string fileName = sourcePath.filename().string();
+	alignas(inotify_event) char buffer[4096];
+	pollfd handles[2] = { { notify, POLLIN, 0 }, { StopPipe[0], POLLIN, 0 } };
+	while (Running)
+	{
+		if (poll(handles, 2, -1) < 0) continue;
+		if (handles[1].revents) break;
+
+		// Collect events until the file has been quiet for a moment, then reload once.
+		bool matched = false;
+		do
+		{
+			ssize_t length;
+			while ((length = read(notify, buffer, sizeof(buffer))) > 0)
+			{
+				for (char *next = buffer; next < buffer + length; )
+				{
+					inotify_event *event = (inotify_event *)next;
+					if (event->len && fileName == event->name) matched = true;
+					next += sizeof(inotify_event) + event->len;
+				}
+			}
+		} while (matched && poll(handles, 1, 50) > 0);
+
+		if (matched) Poll();
+	}
+	close(notify);
+#endif
+}
+}
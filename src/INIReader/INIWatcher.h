@@ -0,0 +1,91 @@
+#pragma once
+#include <string>
+#include <string_view>
+#include <vector>
+#include <memory>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <atomic>
+
+namespace TChapman500 {
+class INIFile;
+
+// Keeps an INIFile up to date with the file on disk.  When the file changes, it is parsed again
+// and compared with the previous version, and subscribers are told only about the keys that were
+// added, changed or removed.  Readers hold on to a snapshot, so a reload never changes a file
+// that is in use.
+class INIWatcher
+{
+public:
+	enum class change_type
+	{
+		Added,
+		Changed,
+		Removed
+	};
+
+	struct key_change
+	{
+		change_type Type;
+		std::wstring Section;
+		std::wstring Key;
+		std::wstring OldValue;
+		std::wstring NewValue;
+	};
+
+	typedef std::function<void(const std::vector<key_change> &)> callback;
+
+	INIWatcher(const std::wstring &path);
+	~INIWatcher();
+
+	INIWatcher(const INIWatcher &) = delete;
+	INIWatcher &operator=(const INIWatcher &) = delete;
+
+	std::shared_ptr<INIFile> GetFile();
+
+	// An empty section or key matches everything.  Returns an ID for Unsubscribe().
+	size_t Subscribe(callback function, std::wstring_view section = std::wstring_view(), std::wstring_view key = std::wstring_view());
+	void Unsubscribe(size_t id);
+
+	// Watch for changes on a background thread.  Subscribers are called from that thread.
+	bool Start();
+	void Stop();
+
+	// Check the file now.  Returns true if it had changed and was reloaded.
+	bool Poll();
+
+	static std::vector<key_change> Diff(INIFile &oldFile, INIFile &newFile);
+
+private:
+	struct subscriber
+	{
+		size_t ID;
+		std::wstring Section;
+		std::wstring Key;
+		callback Function;
+	};
+
+	std::wstring Path;
+	std::shared_ptr<INIFile> File;
+	unsigned long long SourceSize;
+	long long SourceTime;
+
+	std::mutex Lock;
+	std::mutex PollLock;
+	std::vector<subscriber> Subscribers;
+	size_t NextID;
+
+	std::thread Thread;
+	std::atomic<bool> Running;
+#ifdef _WIN32
+	void *StopEvent;
+#else
+	int StopPipe[2];
+#endif
+
+	bool _GetStamp(unsigned long long &size, long long &time);
+	void _Notify(const std::vector<key_change> &changes);
+	void _Watch();
+};
+}
@@ -0,0 +1,249 @@
+#include "INIWriter.h"
+#include <fstream>
+#include <filesystem>
+#include <iterator>
+#include <algorithm>
+#include <unordered_set>
+
+#include "INIFile.h"
+#include "INISection.h"
+#include "INIKey.h"
+
+namespace TChapman500 {
+static inline bool IsWhitespace(wchar_t c) { return c == L' ' || c == L'\t' || c == L'\n' || c == L'\r' || c == L'\f' || c == L'\v'; }
+
+INIWriter::INIWriter(INIFile &file) : File(file)
+{
+	Separator = L"=";
+	_Load();
+}
+
+INIWriter::~INIWriter() {}
+
+bool INIWriter::SetValue(std::wstring_view section, std::wstring_view key, std::wstring_view value)
+{
+	return File.SetValue(section, key, value) != nullptr;
+}
+
+bool INIWriter::Save() { return Save(File.GetPath()); }
+
+bool INIWriter::Save(const std::wstring &path)
+{
+	bool inserted;
+	std::vector<edit> edits = _Edits(inserted);
+	if (edits.empty() && path == File.GetPath()) return true;
+	std::wstring output = _Apply(Text, edits);
+
+	// Write everything at once to a temporary file, then swap it in so that a reader never sees
+	// half a file.
+	std::filesystem::path finalPath(path);
+	std::filesystem::path tempPath(path + L".tmp");
+	{
+		std::wfstream file(tempPath, std::ios::out | std::ios::trunc);
+		if (!file.is_open()) return false;
+		file.write(output.data(), (std::streamsize)output.size());
+		if (!file) return false;
+	}
+
+	std::error_code error;
+	std::filesystem::rename(tempPath, finalPath, error);
+	if (error) return false;
+
+	// A copy saved somewhere else leaves the original file, and so the text changes are measured
+	// against, as they were.
+	if (path != File.GetPath()) return true;
+
+	// If only values changed, move the ranges after each edit instead of scanning the new text.
+	if (inserted)
+	{
+		Text = std::move(output);
+		_Scan();
+		return true;
+	}
+
+	std::vector<long long> shift(edits.size() + 1, 0);
+	for (size_t i = 0; i < edits.size(); i++)
+		shift[i + 1] = shift[i] + (long long)edits[i].Text.size() - (long long)edits[i].Length;
+
+	for (key_entry &entry : Keys)
+	{
+		size_t before = (size_t)(std::lower_bound(edits.begin(), edits.end(), entry.Offset, [](const edit &e, size_t offset) { return e.Offset < offset; }) - edits.begin());
+		if (before < edits.size() && edits[before].Offset == entry.Offset) entry.Length = edits[before].Text.size();
+		entry.Offset = (size_t)((long long)entry.Offset + shift[before]);
+	}
+	for (section_entry &section : Sections)
+	{
+		size_t before = (size_t)(std::lower_bound(edits.begin(), edits.end(), section.InsertAt, [](const edit &e, size_t offset) { return e.Offset < offset; }) - edits.begin());
+		section.InsertAt = (size_t)((long long)section.InsertAt + shift[before]);
+	}
+	Text = std::move(output);
+	return true;
+}
+
+std::wstring INIWriter::Serialize()
+{
+	bool inserted;
+	return _Apply(Text, _Edits(inserted));
+}
+
+void INIWriter::_Load()
+{
+	std::wfstream file(std::filesystem::path(File.GetPath()), std::ios::in);
+	if (file.is_open()) Text.assign(std::istreambuf_iterator<wchar_t>(file), std::istreambuf_iterator<wchar_t>());
+	_Scan();
+}
+
+void INIWriter::_Scan()
+{
+	Keys.clear();
+	Sections.clear();
+	KeyIndex.clear();
+
+	// Follows the same rules as INIFile, so every value found here is the one INIFile holds.
+	std::unordered_set<std::wstring> seen;
+	bool inSection = false;
+	bool firstSection = false;
+	for (size_t lineStart = 0; lineStart < Text.size(); )
+	{
+		size_t lineEnd = Text.find(L'\n', lineStart);
+		if (lineEnd == std::wstring::npos) lineEnd = Text.size();
+		size_t next = lineEnd < Text.size() ? lineEnd + 1 : lineEnd;
+
+		size_t first = lineStart;
+		while (first < lineEnd && IsWhitespace(Text[first])) first++;
+		lineStart = next;
+
+		// Line is empty or contains only a comment
+		if (first == lineEnd || Text[first] == L';') continue;
+
+		// We are not yet in a section
+		if (!inSection && Text[first] != L'[') continue;
+
+		std::wstring line = Text.substr(first, lineEnd - first);
+		if (Text[first] == L'[')
+		{
+			// Only the first section with a given name is ever looked at.
+			INISection section(line);
+			inSection = true;
+			firstSection = seen.insert(section.GetName()).second;
+			if (firstSection) Sections.push_back(section_entry{ section.GetName(), next });
+			continue;
+		}
+
+		INIKey key(line);
+		if (key.GetName().empty() || !firstSection) continue;
+		Sections.back().InsertAt = next;
+
+		INIKey *iKey = File.GetKey(Sections.back().Name, key.GetName());
+		if (!iKey) continue;
+
+		// The value runs from after the '=' to the comment or the end of the line.
+		size_t equals = Text.find(L'=', first);
+		size_t valueEnd = std::min(Text.find(L';', first), lineEnd);
+		size_t valueStart = equals + 1;
+		while (valueStart < valueEnd && IsWhitespace(Text[valueStart])) valueStart++;
+		while (valueEnd > valueStart && IsWhitespace(Text[valueEnd - 1])) valueEnd--;
+
+		// New keys are written the same way as the others.
+		if (valueEnd > valueStart)
+		{
+			size_t nameEnd = equals;
+			while (nameEnd > first && IsWhitespace(Text[nameEnd - 1])) nameEnd--;
+			Separator = Text.substr(nameEnd, valueStart - nameEnd);
+		}
+
+		// When a key is repeated, the last one holds the value.
+		key_entry entry{ iKey, valueStart, valueEnd - valueStart };
+		auto found = KeyIndex.find(iKey);
+		if (found != KeyIndex.end()) Keys[found->second] = entry;
+		else
+		{
+			KeyIndex[iKey] = Keys.size();
+			Keys.push_back(entry);
+		}
+	}
+}
+
+std::vector<INIWriter::edit> INIWriter::_Edits(bool &inserted)
+{
+	std::vector<edit> edits;
+	inserted = false;
+
+	// Values that changed
+	for (const key_entry &entry : Keys)
+	{
+		const std::wstring &value = entry.Key->GetValue();
+		if (Text.compare(entry.Offset, entry.Length, value) != 0)
+			edits.push_back(edit{ entry.Offset, entry.Length, value });
+	}
+
+	// Keys and sections that are not in the text yet
+	std::unordered_map<std::wstring_view, size_t> textSections;
+	for (size_t i = 0; i < Sections.size(); i++) textSections[Sections[i].Name] = i;
+
+	bool endsWithNewline = Text.empty() || Text.back() == L'\n';
+	std::wstring tail;
+	std::unordered_set<std::wstring_view> seen;
+	for (size_t i = 0; i < File.GetSectionCount(); i++)
+	{
+		INISection *section = File.GetSection(i);
+		if (!seen.insert(section->GetName()).second) continue;
+
+		std::wstring added;
+		for (size_t k = 0; k < section->GetKeyCount(); k++)
+		{
+			INIKey *key = section->GetKey(k);
+			if (KeyIndex.count(key)) continue;
+			added += key->GetName() + Separator + key->GetValue() + L"\n";
+		}
+
+		auto found = textSections.find(section->GetName());
+		if (found == textSections.end())
+		{
+			if (!Text.empty() || !tail.empty()) tail += L"\n";
+			tail += L"[" + section->GetName() + L"]\n" + added;
+			continue;
+		}
+		if (added.empty()) continue;
+
+		size_t insertAt = Sections[found->second].InsertAt;
+		if (insertAt == Text.size() && !endsWithNewline)
+		{
+			added.insert(0, L"\n");
+			endsWithNewline = true;
+		}
+		edits.push_back(edit{ insertAt, 0, added });
+		inserted = true;
+	}
+
+	if (!tail.empty())
+	{
+		if (!endsWithNewline) tail.insert(0, L"\n");
+		edits.push_back(edit{ Text.size(), 0, tail });
+		inserted = true;
+	}
+
+	// Edits at the same place keep their order.
+	std::stable_sort(edits.begin(), edits.end(), [](const edit &a, const edit &b) { return a.Offset < b.Offset; });
+	return edits;
+}
+
+std::wstring INIWriter::_Apply(const std::wstring &text, const std::vector<edit> &edits)
+{
+	size_t size = text.size();
+	for (const edit &change : edits) size += change.Text.size() - change.Length;
+
+	// Copy the text between edits as it is.
+	std::wstring result;
+	result.reserve(size);
+	size_t copied = 0;
+	for (const edit &change : edits)
+	{
+		result.append(text, copied, change.Offset - copied);
+		result += change.Text;
+		copied = change.Offset + change.Length;
+	}
+	result.append(text, copied, std::wstring::npos);
+	return result;
+}
+}
@@ -0,0 +1,66 @@
+#pragma once
+#include <string>
+#include <string_view>
+#include <vector>
+#include <unordered_map>
+
+namespace TChapman500 {
+class INIFile;
+class INIKey;
+
+// Saves an INIFile without losing its comments or formatting.  The writer keeps the text the
+// file was loaded from and where each value sits in it.  Saving compares the values in memory
+// against the text and replaces only the ones that changed, so everything else is copied over
+// as it was.  New keys go at the end of their section and new sections at the end of the file.
+// The result is written once to a temporary file that is then renamed over the original.
+class INIWriter
+{
+public:
+	INIWriter(INIFile &file);
+	~INIWriter();
+
+	// Same as INIFile::SetValue().  The change is written on the next Save().
+	bool SetValue(std::wstring_view section, std::wstring_view key, std::wstring_view value);
+
+	// Saving to any other path writes a copy.  The original file still gets the changes on the
+	// next Save().
+	bool Save();
+	bool Save(const std::wstring &path);
+
+	// Text of the file as it would be saved.
+	std::wstring Serialize();
+
+private:
+	struct key_entry
+	{
+		INIKey *Key;
+		size_t Offset;
+		size_t Length;
+	};
+
+	struct section_entry
+	{
+		std::wstring Name;
+		size_t InsertAt;
+	};
+
+	struct edit
+	{
+		size_t Offset;
+		size_t Length;
+		std::wstring Text;
+	};
+
+	INIFile &File;
+	std::wstring Text;
+	std::wstring Separator;
+	std::vector<key_entry> Keys;
+	std::vector<section_entry> Sections;
+	std::unordered_map<INIKey *, size_t> KeyIndex;
+
+	void _Load();
+	void _Scan();
+	std::vector<edit> _Edits(bool &inserted);
+	static std::wstring _Apply(const std::wstring &text, const std::vector<edit> &edits);
+};
+}
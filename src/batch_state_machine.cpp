@@ -0,0 +1,216 @@
+#include "batch_state_machine.h"
+
+using std::make_shared;
+using std::shared_ptr;
+using std::vector;
+
+namespace TChapman500 {
+
+// Interface does nothing
+IBatchState::~IBatchState() {}
+
+// Null state does nothing but fill state ID 0
+NullBatchState::NullBatchState() {}
+NullBatchState::~NullBatchState() {}
+void NullBatchState::InitializeBatch(BatchStateMachine *context, const unsigned *agents, size_t count) {}
+void NullBatchState::ExecuteBatch(BatchStateMachine *context, const unsigned *agents, size_t count) {}
+void NullBatchState::CleanUpBatch(BatchStateMachine *context, const unsigned *agents, size_t count) {}
+
+BatchStateMachine::BatchStateMachine()
+{
+	_States.push_back(make_shared<NullBatchState>());
+	_AgentCount = 0;
+}
+
+BatchStateMachine::~BatchStateMachine()
+{
+
+}
+
+bool BatchStateMachine::Initialize(IState *context)
+{
+	for (size_t i = 0; i < _Current.size(); i++) _Mask[i] = _Alive[i];
+	_GroupAgents(_Current, _Mask);
+	_RunPhase(&IBatchState::InitializeBatch);
+	return true;
+}
+
+void BatchStateMachine::Execute(IState *context)
+{
+	size_t agentCount = _Current.size();
+	bool pending = false;
+
+	// Agents that were given a new state outside of Execute still need to leave their old one.
+	for (size_t i = 0; i < agentCount; i++)
+	{
+		_Mask[i] = _Alive[i] && _Next[i] != InvalidID && _Current[i] != NullStateID;
+		pending |= _Next[i] != InvalidID;
+	}
+	if (pending)
+	{
+		_GroupAgents(_Current, _Mask);
+		_RunPhase(&IBatchState::CleanUpBatch);
+
+		// Initialize the new states
+		for (size_t i = 0; i < agentCount; i++)
+		{
+			_Mask[i] = _Alive[i] && _Next[i] != InvalidID;
+			if (_Mask[i])
+			{
+				_Current[i] = _Next[i];
+				_Next[i] = InvalidID;
+			}
+		}
+		_GroupAgents(_Current, _Mask);
+		_RunPhase(&IBatchState::InitializeBatch);
+	}
+
+	// Execute the current states
+	for (size_t i = 0; i < agentCount; i++) _Mask[i] = _Alive[i];
+	_GroupAgents(_Current, _Mask);
+	_RunPhase(&IBatchState::ExecuteBatch);
+
+	// Clean up old states and removed agents
+	bool cleanUp = false;
+	for (size_t i = 0; i < agentCount; i++)
+	{
+		_Mask[i] = _Alive[i] && (_Next[i] != InvalidID || _Removed[i]);
+		cleanUp |= _Mask[i] != 0;
+	}
+	if (!cleanUp) return;
+
+	_GroupAgents(_Current, _Mask);
+	_RunPhase(&IBatchState::CleanUpBatch);
+	for (size_t i = 0; i < agentCount; i++)
+	{
+		if (!_Mask[i]) continue;
+		_Current[i] = NullStateID;
+
+		// Free the agent's slot so that it can be reused.
+		if (_Removed[i])
+		{
+			_Next[i] = InvalidID;
+			_Alive[i] = 0;
+			_Removed[i] = 0;
+			_FreeAgents.push_back((unsigned)i);
+			_AgentCount--;
+		}
+	}
+}
+
+void BatchStateMachine::CleanUp(IState *context)
+{
+	for (size_t i = 0; i < _Current.size(); i++) _Mask[i] = _Alive[i];
+	_GroupAgents(_Current, _Mask);
+	_RunPhase(&IBatchState::CleanUpBatch);
+}
+
+unsigned BatchStateMachine::AddState(shared_ptr<IBatchState> state)
+{
+	if (!state) return InvalidID;
+
+	// Check to see if the state already exists
+	for (size_t i = 0; i < _States.size(); i++)
+	{
+		if (_States[i] == state)
+			return (unsigned)i;
+	}
+
+	_States.push_back(state);
+	return (unsigned)(_States.size() - 1);
+}
+
+shared_ptr<IBatchState> BatchStateMachine::GetStateObject(unsigned state)
+{
+	if (state >= _States.size()) return nullptr;
+	return _States[state];
+}
+
+size_t BatchStateMachine::GetStateCount() { return _States.size(); }
+
+unsigned BatchStateMachine::AddAgent(unsigned state)
+{
+	if (state >= _States.size()) return InvalidID;
+
+	// Reuse a free slot if there is one.
+	unsigned agent;
+	if (!_FreeAgents.empty())
+	{
+		agent = _FreeAgents.back();
+		_FreeAgents.pop_back();
+	}
+	else
+	{
+		agent = (unsigned)_Current.size();
+		_Current.push_back(NullStateID);
+		_Next.push_back(InvalidID);
+		_Alive.push_back(0);
+		_Removed.push_back(0);
+		_Mask.push_back(0);
+	}
+
+	_Current[agent] = NullStateID;
+	_Next[agent] = state == NullStateID ? InvalidID : state;
+	_Alive[agent] = 1;
+	_Removed[agent] = 0;
+	_AgentCount++;
+	return agent;
+}
+
+bool BatchStateMachine::RemoveAgent(unsigned agent)
+{
+	if (agent >= _Current.size() || !_Alive[agent] || _Removed[agent]) return false;
+	_Removed[agent] = 1;
+	return true;
+}
+
+size_t BatchStateMachine::GetAgentCount() { return _AgentCount; }
+
+bool BatchStateMachine::SetState(unsigned agent, unsigned state)
+{
+	if (agent >= _Current.size() || !_Alive[agent]) return false;
+	if (state >= _States.size() || state == _Current[agent]) return false;
+
+	_Next[agent] = state;
+	return true;
+}
+
+unsigned BatchStateMachine::GetState(unsigned agent)
+{
+	if (agent >= _Current.size() || !_Alive[agent]) return InvalidID;
+	return _Current[agent];
+}
+
+void BatchStateMachine::_GroupAgents(const vector<unsigned> &stateIDs, const vector<unsigned char> &mask)
+{
+	// Counting sort of the masked agents by state ID.
+	size_t stateCount = _States.size();
+	_GroupStart.assign(stateCount + 1, 0);
+	for (size_t i = 0; i < stateIDs.size(); i++)
+	{
+		if (mask[i]) _GroupStart[stateIDs[i] + 1]++;
+	}
+	for (size_t i = 0; i < stateCount; i++) _GroupStart[i + 1] += _GroupStart[i];
+
+	_Grouped.resize(_GroupStart[stateCount]);
+	for (size_t i = 0; i < stateIDs.size(); i++)
+	{
+		if (mask[i]) _Grouped[_GroupStart[stateIDs[i]]++] = (unsigned)i;
+	}
+
+	// Filling the groups moved every start to the end of its group.
+	for (size_t i = stateCount; i > 0; i--) _GroupStart[i] = _GroupStart[i - 1];
+	_GroupStart[0] = 0;
+}
+
+void BatchStateMachine::_RunPhase(void (IBatchState:: *phase)(BatchStateMachine *, const unsigned *, size_t))
+{
+	// The null state never does anything, so its group is skipped.
+	for (size_t i = 1; i + 1 < _GroupStart.size(); i++)
+	{
+		size_t count = _GroupStart[i + 1] - _GroupStart[i];
+		if (count) (_States[i].get()->*phase)(this, _Grouped.data() + _GroupStart[i], count);
+	}
+}
+
+}
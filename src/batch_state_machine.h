@@ -0,0 +1,82 @@
+#pragma once
+#include <memory>
+#include <vector>
+#include "state_machine.h"
+
+namespace TChapman500
+{
+	class BatchStateMachine;
+
+	// A state shared by every agent of a batch state machine.  Instead of being called
+	// once per agent, each function receives every agent that is currently in this state.
+	class IBatchState
+	{
+	public:
+		virtual ~IBatchState();
+
+		virtual void InitializeBatch(BatchStateMachine *context, const unsigned *agents, size_t count) = 0;
+		virtual void ExecuteBatch(BatchStateMachine *context, const unsigned *agents, size_t count) = 0;
+		virtual void CleanUpBatch(BatchStateMachine *context, const unsigned *agents, size_t count) = 0;
+	};
+
+	class NullBatchState : public IBatchState
+	{
+	public:
+		NullBatchState();
+		~NullBatchState();
+
+		virtual void InitializeBatch(BatchStateMachine *context, const unsigned *agents, size_t count) final;
+		virtual void ExecuteBatch(BatchStateMachine *context, const unsigned *agents, size_t count) final;
+		virtual void CleanUpBatch(BatchStateMachine *context, const unsigned *agents, size_t count) final;
+	};
+
+	// Runs the same state machine for many agents at once.  The current and next state of every
+	// agent is stored in contiguous arrays, and every tick the agents are grouped by state so that
+	// each state is called once per phase instead of once per agent.  The transition rules match
+	// StateMachine: a new state is initialized at the start of the following tick, and the old
+	// state is cleaned up at the end of the tick in which the new state was set.
+	class BatchStateMachine : public IState
+	{
+	public:
+		static constexpr unsigned NullStateID = 0;
+		static constexpr unsigned InvalidID = ~0U;
+
+		BatchStateMachine();
+		~BatchStateMachine();
+
+		virtual bool Initialize(IState *context) override;
+		virtual void Execute(IState *context) override;
+		virtual void CleanUp(IState *context) override;
+
+		unsigned AddState(std::shared_ptr<IBatchState> state);
+		std::shared_ptr<IBatchState> GetStateObject(unsigned state);
+		size_t GetStateCount();
+
+		// New agents start in the null state and enter "state" on the next tick.
+		unsigned AddAgent(unsigned state);
+		bool RemoveAgent(unsigned agent);
+		size_t GetAgentCount();
+
+		bool SetState(unsigned agent, unsigned state);
+		unsigned GetState(unsigned agent);
+
+	private:
+		void _GroupAgents(const std::vector<unsigned> &stateIDs, const std::vector<unsigned char> &mask);
+		void _RunPhase(void (IBatchState:: *phase)(BatchStateMachine *, const unsigned *, size_t));
+
+		std::vector<std::shared_ptr<IBatchState>> _States;
+
+		// Per-agent data, indexed by agent ID.
+		std::vector<unsigned> _Current;
+		std::vector<unsigned> _Next;
+		std::vector<unsigned char> _Alive;
+		std::vector<unsigned char> _Removed;
+		std::vector<unsigned> _FreeAgents;
+		size_t _AgentCount;
+
+		// Scratch buffers for grouping agents by state.
+		std::vector<unsigned char> _Mask;
+		std::vector<unsigned> _Grouped;
+		std::vector<size_t> _GroupStart;
+	};
+}
@@ -1,12 +1,17 @@
 #pragma once
 #include <math.h>
 #include <stdlib.h>
+#include <vector>
+#include "thread_pool.h"
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
 
 namespace TChapman500 {
 namespace Elo {
 
 // Calculate delta specifying the winner.
-int calculate_delta(int elo1, int elo2, int k, bool player1Won)
+inline int calculate_delta(int elo1, int elo2, int k, bool player1Won)
 {
 	// Calcualte probability of player 1 victory.
 	double probability = 1.0 / (1.0 + pow(10.0, (((double)elo2 - (double)elo1) / 400.0)));
@@ -20,7 +25,7 @@ int calculate_delta(int elo1, int elo2, int k, bool player1Won)
 }
 
 // Calculate delta assuming player 1 won the match.
-int calculate_delta(int elo1, int elo2, int k)
+inline int calculate_delta(int elo1, int elo2, int k)
 {
 	// Calcualte probability of player 1 victory.
 	double probability = 1.0 / (1.0 + pow(10.0, (((double)elo2 - (double)elo1) / 400.0)));
@@ -30,7 +35,7 @@ int calculate_delta(int elo1, int elo2, int k)
 }
 
 // Apply delta specifying the winner.
-void apply_delta(int &elo1, int &elo2, int k, bool player1Won)
+inline void apply_delta(int &elo1, int &elo2, int k, bool player1Won)
 {
 	int delta = calculate_delta(elo1, elo2, k, player1Won);
 	elo1 += delta;
@@ -38,14 +43,199 @@ void apply_delta(int &elo1, int &elo2, int k, bool player1Won)
 }
 
 // Apply delta assuming player 1 won the match.
-void apply_delta(int &elo1, int &elo2, int k)
+inline void apply_delta(int &elo1, int &elo2, int k)
 {
 	int delta = calculate_delta(elo1, elo2, k);
 	elo1 += delta;
 	elo2 -= delta;
 }
 
+#ifdef __AVX2__
+// 2^x for 8 floats.  Relative error is about 2e-7 over the range used by Elo.
+inline __m256 exp2_ps(__m256 x)
+{
+	x = _mm256_min_ps(_mm256_max_ps(x, _mm256_set1_ps(-126.0f)), _mm256_set1_ps(126.0f));
+
+	// Split into integer and fractional parts, with the fraction in [-0.5, 0.5].
+	__m256 whole = _mm256_round_ps(x, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+	__m256 f = _mm256_sub_ps(x, whole);
+
+	// Polynomial approximation of 2^f (Cephes exp2f).
+	__m256 p = _mm256_set1_ps(1.535336188319500e-4f);
+	p = _mm256_add_ps(_mm256_mul_ps(p, f), _mm256_set1_ps(1.339887440266574e-3f));
+	p = _mm256_add_ps(_mm256_mul_ps(p, f), _mm256_set1_ps(9.618437357674640e-3f));
+	p = _mm256_add_ps(_mm256_mul_ps(p, f), _mm256_set1_ps(5.550332471162809e-2f));
+	p = _mm256_add_ps(_mm256_mul_ps(p, f), _mm256_set1_ps(2.402264791363012e-1f));
+	p = _mm256_add_ps(_mm256_mul_ps(p, f), _mm256_set1_ps(6.931472028550421e-1f));
+	p = _mm256_add_ps(_mm256_mul_ps(p, f), _mm256_set1_ps(1.0f));
+
+	// Scale by 2^whole through the exponent bits.
+	__m256i exponent = _mm256_slli_epi32(_mm256_add_epi32(_mm256_cvtps_epi32(whole), _mm256_set1_epi32(127)), 23);
+	return _mm256_mul_ps(p, _mm256_castsi256_ps(exponent));
+}
+
+// Deltas for 8 matches.  Lanes whose unrounded delta lands too close to a rounding boundary
+// for the approximation to be trusted are flagged in the returned mask and must be
+// recalculated with calculate_delta().  The error of the approximation grows with k, and so does
+// the margin.  Every k with a magnitude below 2^20 is covered.
+inline int calculate_delta8(__m256i elo1, __m256i elo2, __m256i k, __m256i player1Won, __m256i &delta)
+{
+	// log2(10) / 400
+	const __m256 scale = _mm256_set1_ps(0.0083048202372184f);
+	const __m256 one = _mm256_set1_ps(1.0f);
+	const __m256 half = _mm256_set1_ps(0.5f);
+
+	__m256 exponent = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_sub_epi32(elo2, elo1)), scale);
+	__m256 probability = _mm256_div_ps(one, _mm256_add_ps(one, exp2_ps(exponent)));
+
+	// k * (1 - p) when player 1 won, k * (0 - p) otherwise.
+	__m256 won = _mm256_and_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(player1Won, _mm256_setzero_si256())), one);
+	__m256 result = _mm256_mul_ps(_mm256_cvtepi32_ps(k), _mm256_sub_ps(won, probability));
+
+	// round() rounds halves away from zero, so any value near a half is left to the scalar path.
+	const __m256 sign = _mm256_set1_ps(-0.0f);
+	__m256 margin = _mm256_add_ps(_mm256_set1_ps(1.0e-3f), _mm256_mul_ps(_mm256_andnot_ps(sign, _mm256_cvtepi32_ps(k)), _mm256_set1_ps(2.0e-6f)));
+	__m256 floored = _mm256_floor_ps(result);
+	__m256 distance = _mm256_sub_ps(_mm256_sub_ps(result, floored), half);
+	distance = _mm256_andnot_ps(sign, distance);
+	int unsure = _mm256_movemask_ps(_mm256_cmp_ps(distance, margin, _CMP_LT_OQ));
+
+	delta = _mm256_cvtps_epi32(_mm256_floor_ps(_mm256_add_ps(result, half)));
+	return unsure;
+}
+#endif
+
+// Calculate the deltas of independent matches.  Results are identical to calculate_delta().
+inline void calculate_deltas(const int *elo1, const int *elo2, const int *k, const bool *player1Won, int *deltas, size_t count)
+{
+	size_t i = 0;
+#ifdef __AVX2__
+	for (; i + 8 <= count; i += 8)
+	{
+		__m256i mElo1 = _mm256_loadu_si256((const __m256i *)(elo1 + i));
+		__m256i mElo2 = _mm256_loadu_si256((const __m256i *)(elo2 + i));
+		__m256i mK = _mm256_loadu_si256((const __m256i *)(k + i));
+		__m256i mWon = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(player1Won + i)));
+
+		__m256i mDelta;
+		int unsure = calculate_delta8(mElo1, mElo2, mK, mWon, mDelta);
+		_mm256_storeu_si256((__m256i *)(deltas + i), mDelta);
+
+		for (size_t lane = i; unsure; lane++, unsure >>= 1)
+		{
+			if (unsure & 1) deltas[lane] = calculate_delta(elo1[lane], elo2[lane], k[lane], player1Won[lane]);
+		}
+	}
+#endif
+	for (; i < count; i++) deltas[i] = calculate_delta(elo1[i], elo2[i], k[i], player1Won[i]);
+}
+
+// Apply a chronological list of matches to an array of ratings indexed by player.  Matches are
+// evaluated 8 at a time, but the deltas are committed in order, and any match whose player was
+// changed by an earlier match in the same group is recalculated.  The final ratings are
+// identical to calling apply_delta() on each match in order.
+inline void apply_deltas(int *ratings, const unsigned *player1, const unsigned *player2, const int *k, const bool *player1Won, size_t count)
+{
+	size_t i = 0;
+#ifdef __AVX2__
+	for (; i + 8 <= count; i += 8)
+	{
+		__m256i index1 = _mm256_loadu_si256((const __m256i *)(player1 + i));
+		__m256i index2 = _mm256_loadu_si256((const __m256i *)(player2 + i));
+		__m256i mElo1 = _mm256_i32gather_epi32(ratings, index1, 4);
+		__m256i mElo2 = _mm256_i32gather_epi32(ratings, index2, 4);
+		__m256i mK = _mm256_loadu_si256((const __m256i *)(k + i));
+		__m256i mWon = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(player1Won + i)));
+
+		__m256i mDelta;
+		int unsure = calculate_delta8(mElo1, mElo2, mK, mWon, mDelta);
+
+		alignas(32) int elo1[8];
+		alignas(32) int elo2[8];
+		alignas(32) int delta[8];
+		_mm256_store_si256((__m256i *)elo1, mElo1);
+		_mm256_store_si256((__m256i *)elo2, mElo2);
+		_mm256_store_si256((__m256i *)delta, mDelta);
+
+		for (unsigned lane = 0; lane < 8; lane++)
+		{
+			int &rating1 = ratings[player1[i + lane]];
+			int &rating2 = ratings[player2[i + lane]];
+
+			// Ratings moved since they were gathered, or the delta was too close to call.
+			int value = delta[lane];
+			if (rating1 != elo1[lane] || rating2 != elo2[lane] || (unsure >> lane) & 1)
+				value = calculate_delta(rating1, rating2, k[i + lane], player1Won[i + lane]);
+
+			rating1 += value;
+			rating2 -= value;
+		}
+	}
+#endif
+	for (; i < count; i++) apply_delta(ratings[player1[i]], ratings[player2[i]], k[i], player1Won[i]);
+}
+
+// Matches split into waves in which no player appears twice.  Every match comes after all of
+// the earlier matches of both of its players, so running the waves in order (and the matches
+// of a wave in any order) gives the same ratings as running the matches in order.
+struct match_schedule
+{
+	std::vector<unsigned> Order;		// Match indices, grouped by wave.
+	std::vector<size_t> WaveStart;		// Wave i is Order[WaveStart[i]] to Order[WaveStart[i + 1]].
+};
 
+inline void schedule_matches(const unsigned *player1, const unsigned *player2, size_t count, size_t playerCount, match_schedule &schedule)
+{
+	// A match goes in the wave after the latest wave of either player.
+	std::vector<unsigned> playerWave(playerCount, 0);
+	std::vector<unsigned> matchWave(count);
+	unsigned waveCount = 0;
+	for (size_t i = 0; i < count; i++)
+	{
+		unsigned wave1 = playerWave[player1[i]];
+		unsigned wave2 = playerWave[player2[i]];
+		unsigned wave = wave1 > wave2 ? wave1 : wave2;
+		matchWave[i] = wave;
+		playerWave[player1[i]] = wave + 1;
+		playerWave[player2[i]] = wave + 1;
+		if (wave + 1 > waveCount) waveCount = wave + 1;
+	}
+
+	// Counting sort by wave, keeping the chronological order within each wave.
+	schedule.WaveStart.assign((size_t)waveCount + 1, 0);
+	for (size_t i = 0; i < count; i++) schedule.WaveStart[(size_t)matchWave[i] + 1]++;
+	for (size_t i = 0; i < waveCount; i++) schedule.WaveStart[i + 1] += schedule.WaveStart[i];
 
+	std::vector<size_t> next(schedule.WaveStart.begin(), schedule.WaveStart.end() - 1);
+	schedule.Order.resize(count);
+	for (size_t i = 0; i < count; i++) schedule.Order[next[matchWave[i]]++] = (unsigned)i;
+}
+
+// Apply a chronological list of matches with each wave split across the pool's threads.
+// The final ratings are identical to calling apply_delta() on each match in order.
+inline void apply_deltas_parallel(int *ratings, const unsigned *player1, const unsigned *player2, const int *k, const bool *player1Won, const match_schedule &schedule, thread_pool &pool)
+{
+	// Small waves are not worth waking other threads for.
+	const size_t minChunk = 4096;
+	for (size_t wave = 0; wave + 1 < schedule.WaveStart.size(); wave++)
+	{
+		const unsigned *order = schedule.Order.data() + schedule.WaveStart[wave];
+		size_t waveSize = schedule.WaveStart[wave + 1] - schedule.WaveStart[wave];
+		pool.parallel_for(waveSize, minChunk, [=](size_t begin, size_t end) {
+			for (size_t i = begin; i < end; i++)
+			{
+				unsigned match = order[i];
+				apply_delta(ratings[player1[match]], ratings[player2[match]], k[match], player1Won[match]);
+			}
+		});
+	}
+}
+
+inline void apply_deltas_parallel(int *ratings, size_t playerCount, const unsigned *player1, const unsigned *player2, const int *k, const bool *player1Won, size_t count)
+{
+	match_schedule schedule;
+	schedule_matches(player1, player2, count, playerCount, schedule);
+	apply_deltas_parallel(ratings, player1, player2, k, player1Won, schedule, thread_pool::shared());
+}
 
 }}
@@ -0,0 +1,117 @@
+#pragma once
+#include <math.h>
+#include <vector>
+
+namespace TChapman500 {
+namespace Glicko2 {
+
+// Glicko-2 ratings as described by Mark Glickman.  Ratings are stored as structures of arrays
+// on the usual Glicko scale (1500 / 350 / 0.06 for a new player) and are updated a whole rating
+// period at a time: every match in the period is rated against the opponents' ratings from
+// before the period, as the system requires.
+
+const double DefaultRating = 1500.0;
+const double DefaultDeviation = 350.0;
+const double DefaultVolatility = 0.06;
+
+// Converts between the Glicko and Glicko-2 scales.
+const double Scale = 173.7178;
+
+inline double g(double phi) { return 1.0 / sqrt(1.0 + 3.0 * phi * phi / (3.14159265358979324 * 3.14159265358979324)); }
+inline double expected_score(double mu, double muOpponent, double gOpponent) { return 1.0 / (1.0 + exp(-gOpponent * (mu - muOpponent))); }
+
+// New volatility through the Illinois algorithm (step 5 of the paper).
+inline double solve_volatility(double phi, double sigma, double v, double delta, double tau)
+{
+	const double epsilon = 0.000001;
+	double phi2 = phi * phi;
+	double delta2 = delta * delta;
+	double a = log(sigma * sigma);
+	double tau2 = tau * tau;
+	auto f = [=](double x) -> double {
+		double ex = exp(x);
+		double d = phi2 + v + ex;
+		return (ex * (delta2 - phi2 - v - ex)) / (2.0 * d * d) - (x - a) / tau2;
+	};
+
+	double A = a;
+	double B;
+	if (delta2 > phi2 + v) B = log(delta2 - phi2 - v);
+	else
+	{
+		double k = 1.0;
+		while (f(a - k * tau) < 0.0) k += 1.0;
+		B = a - k * tau;
+	}
+
+	double fA = f(A);
+	double fB = f(B);
+	while (fabs(B - A) > epsilon)
+	{
+		double C = A + (A - B) * fA / (fB - fA);
+		double fC = f(C);
+		if (fC * fB <= 0.0)
+		{
+			A = B;
+			fA = fB;
+		}
+		else fA /= 2.0;
+		B = C;
+		fB = fC;
+	}
+	return exp(A / 2.0);
+}
+
+// Rate one period.  score1 is player 1's result of each match (1 win, 0.5 draw, 0 loss).
+// Players without a match in the period only have their deviation grow.  tau constrains how
+// fast volatility changes; Glickman suggests 0.3 to 1.2.
+inline void update_period(double *rating, double *deviation, double *volatility, size_t playerCount,
+	const unsigned *player1, const unsigned *player2, const double *score1, size_t matchCount, double tau = 0.5)
+{
+	// Per player sums of g(phi)^2 E (1 - E) and g(phi) (s - E).
+	std::vector<double> variance(playerCount, 0.0);
+	std::vector<double> improvement(playerCount, 0.0);
+	std::vector<double> gPlayer(playerCount);
+	for (size_t i = 0; i < playerCount; i++) gPlayer[i] = g(deviation[i] / Scale);
+
+	for (size_t i = 0; i < matchCount; i++)
+	{
+		unsigned p1 = player1[i];
+		unsigned p2 = player2[i];
+		double mu1 = (rating[p1] - DefaultRating) / Scale;
+		double mu2 = (rating[p2] - DefaultRating) / Scale;
+
+		double expected1 = expected_score(mu1, mu2, gPlayer[p2]);
+		double expected2 = expected_score(mu2, mu1, gPlayer[p1]);
+
+		variance[p1] += gPlayer[p2] * gPlayer[p2] * expected1 * (1.0 - expected1);
+		variance[p2] += gPlayer[p1] * gPlayer[p1] * expected2 * (1.0 - expected2);
+		improvement[p1] += gPlayer[p2] * (score1[i] - expected1);
+		improvement[p2] += gPlayer[p1] * ((1.0 - score1[i]) - expected2);
+	}
+
+	for (size_t i = 0; i < playerCount; i++)
+	{
+		double phi = deviation[i] / Scale;
+
+		// Did not play this period.
+		if (variance[i] == 0.0)
+		{
+			deviation[i] = sqrt(phi * phi + volatility[i] * volatility[i]) * Scale;
+			continue;
+		}
+
+		double v = 1.0 / variance[i];
+		double delta = v * improvement[i];
+		double sigma = solve_volatility(phi, volatility[i], v, delta, tau);
+
+		double phiStar = sqrt(phi * phi + sigma * sigma);
+		double newPhi = 1.0 / sqrt(1.0 / (phiStar * phiStar) + 1.0 / v);
+
+		rating[i] += newPhi * newPhi * improvement[i] * Scale;
+		deviation[i] = newPhi * Scale;
+		volatility[i] = sigma;
+	}
+}
+
+}}
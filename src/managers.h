@@ -1,54 +1,383 @@
 #pragma once
 #include <vector>
+#include <deque>
 #include <string>
+#include <string_view>
 #include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <functional>
+#include <future>
+#include <atomic>
+#include "thread_pool.h"
 
 namespace TChapman500 {
 
+// Names are interned the first time they are seen and keep their handle for the life of the
+// program, even after the item is removed.  Lookups by name go through an open-addressed hash
+// table and never copy the name.  Any number of threads may look items up at the same time.
+//
+// A byte budget can optionally be set.  Once the items add up to more than the budget, items
+// that nobody outside the manager holds a reference to are evicted in CLOCK order (an item
+// that was looked up since the hand last passed it gets a second chance).
 template<typename T> class Manager
 {
 public:
-	static inline std::shared_ptr<T> GetItem(std::wstring name)
+	typedef size_t handle;
+	static constexpr handle InvalidHandle = ~(size_t)0;
+
+	static inline size_t Hash(std::wstring_view name) { return std::hash<std::wstring_view>()(name); }
+
+	// Get the handle of a name, interning it if it has not been seen before.
+	static inline handle Intern(std::wstring_view name) { return Intern(name, Hash(name)); }
+	static inline handle Intern(std::wstring_view name, size_t hash)
 	{
-		for (const std::pair<std::wstring, std::shared_ptr<T>> &item : _Items)
 		{
-			if (item.first == name)
-				return item.second;
+			std::shared_lock<std::shared_mutex> lock(_Mutex);
+			handle result = _Find(name, hash);
+			if (result != InvalidHandle) return result;
 		}
-		return nullptr;
+
+		std::unique_lock<std::shared_mutex> lock(_Mutex);
+		return _Intern(name, hash);
+	}
+
+	// Get the handle of a name without interning it.
+	static inline handle GetHandle(std::wstring_view name) { return GetHandle(name, Hash(name)); }
+	static inline handle GetHandle(std::wstring_view name, size_t hash)
+	{
+		std::shared_lock<std::shared_mutex> lock(_Mutex);
+		return _Find(name, hash);
 	}
-	
-	static inline bool AddItem(std::wstring name, std::shared_ptr<T> &item)
+
+	static inline std::shared_ptr<T> GetItem(std::wstring_view name) { return GetItem(name, Hash(name)); }
+	static inline std::shared_ptr<T> GetItem(std::wstring_view name, size_t hash)
 	{
-		for (const std::pair<std::wstring, std::shared_ptr<T>> &xItem : _Items)
+		std::shared_lock<std::shared_mutex> lock(_Mutex);
+		return _Get(_Find(name, hash));
+	}
+	static inline std::shared_ptr<T> GetItem(handle index)
+	{
+		std::shared_lock<std::shared_mutex> lock(_Mutex);
+		return _Get(index);
+	}
+
+	// A size of 0 asks the sizer for the item's size, if one has been set.
+	static inline bool AddItem(std::wstring_view name, const std::shared_ptr<T> &item, size_t size = 0)
+	{
+		size_t hash = Hash(name);
+		std::unique_lock<std::shared_mutex> lock(_Mutex);
+		handle index = _Intern(name, hash);
+		if (_Items[index].Item) return false;
+
+		_Set(index, item, size);
+		_Evict();
+		return true;
+	}
+
+	static inline bool RemoveItem(std::wstring_view name) { return RemoveItem(GetHandle(name)); }
+	static inline bool RemoveItem(handle index)
+	{
+		std::unique_lock<std::shared_mutex> lock(_Mutex);
+		if (index >= _Items.size() || !_Items[index].Item) return false;
+
+		// The name stays interned so that its handle remains valid.
+		_Items[index].Item = nullptr;
+		_BytesUsed -= _Items[index].Size;
+		_Items[index].Size = 0;
+		return true;
+	}
+
+	typedef std::function<std::shared_ptr<T>(const std::wstring &name)> loader;
+	typedef std::function<void(handle index, const std::shared_ptr<T> &item)> load_callback;
+
+	// Load an item on the shared thread pool and add it under the given name.  Requests for a
+	// name that is already loading share the first request's future instead of loading it
+	// again, and requests for an item that already exists complete immediately.  Callbacks run
+	// on the loading thread, or on the calling thread if the item already exists.  A loader
+	// that returns nullptr leaves nothing added.
+	static inline std::shared_future<std::shared_ptr<T>> LoadAsync(std::wstring_view name, loader load, load_callback callback = nullptr)
+	{
+		size_t hash = Hash(name);
+		std::unique_lock<std::shared_mutex> lock(_Mutex);
+		handle index = _Intern(name, hash);
+		item_slot &slot = _Items[index];
+
+		// Already loaded.
+		if (slot.Item)
 		{
-			if (xItem.first == name)
-				return false;
+			_Hits++;
+			slot.Referenced = true;
+			std::shared_ptr<T> item = slot.Item;
+			lock.unlock();
+
+			std::promise<std::shared_ptr<T>> promise;
+			promise.set_value(item);
+			if (callback) callback(index, item);
+			return promise.get_future().share();
 		}
-		
-		_Items.push_back(std::pair<std::wstring, std::shared_ptr<T>>(name, item));
-		return true;
+
+		// Already loading.
+		if (slot.Loading.valid())
+		{
+			if (callback) slot.Callbacks.push_back(callback);
+			return slot.Loading;
+		}
+
+		_Misses++;
+		std::shared_ptr<std::promise<std::shared_ptr<T>>> promise = std::make_shared<std::promise<std::shared_ptr<T>>>();
+		slot.Loading = promise->get_future().share();
+		if (callback) slot.Callbacks.push_back(callback);
+		std::shared_future<std::shared_ptr<T>> result = slot.Loading;
+		std::wstring itemName = slot.Name;
+		lock.unlock();
+
+		thread_pool::shared().run([index, itemName, load, promise]() {
+			std::shared_ptr<T> item;
+			std::exception_ptr error;
+			try { item = load(itemName); }
+			catch (...) { error = std::current_exception(); }
+
+			// Publish the item before anyone waiting on it wakes up.
+			std::vector<load_callback> callbacks;
+			{
+				std::unique_lock<std::shared_mutex> lock(_Mutex);
+				item_slot &slot = _Items[index];
+				if (!slot.Item && item)
+				{
+					_Set(index, item, 0);
+					_Evict();
+				}
+				else if (slot.Item) item = slot.Item;
+				slot.Loading = std::shared_future<std::shared_ptr<T>>();
+				callbacks.swap(slot.Callbacks);
+			}
+
+			if (error) promise->set_exception(error);
+			else promise->set_value(item);
+			if (!error) for (const load_callback &callback : callbacks) callback(index, item);
+		});
+		return result;
+	}
+
+	static inline bool IsLoading(handle index)
+	{
+		std::shared_lock<std::shared_mutex> lock(_Mutex);
+		if (index >= _Items.size()) return false;
+		return _Items[index].Loading.valid();
+	}
+
+	typedef std::function<size_t(const T &item)> sizer;
+
+	struct cache_stats
+	{
+		size_t Hits;
+		size_t Misses;
+		size_t Evictions;
+		size_t BytesUsed;
+		size_t Budget;
+	};
+
+	// A budget of 0 (the default) never evicts anything.
+	static inline void SetBudget(size_t budget)
+	{
+		std::unique_lock<std::shared_mutex> lock(_Mutex);
+		_Budget = budget;
+		_Evict();
+	}
+
+	// Used to get the size of items added without an explicit size.
+	static inline void SetSizer(sizer size)
+	{
+		std::unique_lock<std::shared_mutex> lock(_Mutex);
+		_Sizer = size;
+	}
+
+	static inline cache_stats GetStats()
+	{
+		std::shared_lock<std::shared_mutex> lock(_Mutex);
+		cache_stats result;
+		result.Hits = _Hits;
+		result.Misses = _Misses;
+		result.Evictions = _Evictions;
+		result.BytesUsed = _BytesUsed;
+		result.Budget = _Budget;
+		return result;
 	}
-	
-	static inline bool RemoveItem(std::wstring name)
+
+	static inline void ResetStats()
+	{
+		std::unique_lock<std::shared_mutex> lock(_Mutex);
+		_Hits = 0;
+		_Misses = 0;
+		_Evictions = 0;
+	}
+
+	static inline const std::wstring &GetName(handle index)
 	{
-		for (size_t i = 0; i < _Items.size(); i++)
+		static const std::wstring empty;
+		std::shared_lock<std::shared_mutex> lock(_Mutex);
+		if (index >= _Items.size()) return empty;
+		return _Items[index].Name;
+	}
+
+private:
+	struct item_slot
+	{
+		std::wstring Name;
+		size_t Hash;
+		std::shared_ptr<T> Item;
+		std::shared_future<std::shared_ptr<T>> Loading;
+		std::vector<load_callback> Callbacks;
+		size_t Size;
+		std::atomic<bool> Referenced;
+	};
+
+	// Caller must hold the lock.
+	static inline std::shared_ptr<T> _Get(handle index)
+	{
+		if (index >= _Items.size() || !_Items[index].Item)
+		{
+			_Misses++;
+			return nullptr;
+		}
+
+		_Hits++;
+		_Items[index].Referenced.store(true, std::memory_order_relaxed);
+		return _Items[index].Item;
+	}
+
+	// Caller must hold the exclusive lock.
+	static inline void _Set(handle index, const std::shared_ptr<T> &item, size_t size)
+	{
+		if (size == 0 && _Sizer) size = _Sizer(*item);
+
+		item_slot &slot = _Items[index];
+		slot.Item = item;
+		slot.Size = size;
+		slot.Referenced = true;
+		_BytesUsed += size;
+	}
+
+	// Caller must hold the exclusive lock.
+	static inline void _Evict()
+	{
+		if (_Budget == 0 || _Items.empty()) return;
+
+		// Two full turns clear every reference bit, so anything still left is in use.
+		for (size_t steps = 0; _BytesUsed > _Budget && steps < _Items.size() * 2; steps++)
 		{
-			const std::pair<std::wstring, std::shared_ptr<T>> &xItem = _Items[i];
-			if (xItem.name == name)
+			if (_ClockHand >= _Items.size()) _ClockHand = 0;
+			item_slot &slot = _Items[_ClockHand++];
+			if (!slot.Item) continue;
+
+			if (slot.Referenced)
 			{
-				_Items.erase(_Items.begin() + i);
-				return true;
+				slot.Referenced = false;
+				continue;
 			}
+
+			// Held somewhere else.
+			if (slot.Item.use_count() > 1) continue;
+
+			slot.Item = nullptr;
+			_BytesUsed -= slot.Size;
+			slot.Size = 0;
+			_Evictions++;
 		}
-		return false;
 	}
-	
-private:
-	static std::vector<std::pair<std::wstring, std::shared_ptr<T>>> _Items;
+
+	// Caller must hold the lock.
+	static inline handle _Find(std::wstring_view name, size_t hash)
+	{
+		if (_Table.empty()) return InvalidHandle;
+
+		size_t mask = _Table.size() - 1;
+		for (size_t i = hash & mask; ; i = (i + 1) & mask)
+		{
+			handle index = _Table[i];
+			if (index == InvalidHandle) return InvalidHandle;
+
+			const item_slot &slot = _Items[index];
+			if (slot.Hash == hash && slot.Name == name) return index;
+		}
+	}
+
+	// Caller must hold the exclusive lock.
+	static inline handle _Intern(std::wstring_view name, size_t hash)
+	{
+		handle result = _Find(name, hash);
+		if (result != InvalidHandle) return result;
+
+		// Keep the table at most half full.
+		if ((_Items.size() + 1) * 2 > _Table.size()) _Rehash(_Table.empty() ? 64 : _Table.size() * 2);
+
+		result = _Items.size();
+		_Items.emplace_back();
+		_Items.back().Name = name;
+		_Items.back().Hash = hash;
+		_Items.back().Size = 0;
+		_Items.back().Referenced = false;
+		_Insert(result, hash);
+		return result;
+	}
+
+	static inline void _Insert(handle index, size_t hash)
+	{
+		size_t mask = _Table.size() - 1;
+		size_t i = hash & mask;
+		while (_Table[i] != InvalidHandle) i = (i + 1) & mask;
+		_Table[i] = index;
+	}
+
+	static inline void _Rehash(size_t size)
+	{
+		_Table.assign(size, InvalidHandle);
+		for (size_t i = 0; i < _Items.size(); i++) _Insert(i, _Items[i].Hash);
+	}
+
+	// A deque so that names never move once interned.
+	static std::deque<item_slot> _Items;
+	static std::vector<handle> _Table;
+	static std::shared_mutex _Mutex;
+
+	static sizer _Sizer;
+	static size_t _Budget;
+	static size_t _BytesUsed;
+	static size_t _ClockHand;
+	static std::atomic<size_t> _Hits;
+	static std::atomic<size_t> _Misses;
+	static size_t _Evictions;
 };
 
 template<typename T>
-std::vector<std::pair<std::wstring, std::shared_ptr<T>>> Manager<T>::_Items;
+std::deque<typename Manager<T>::item_slot> Manager<T>::_Items;
+
+template<typename T>
+std::vector<typename Manager<T>::handle> Manager<T>::_Table;
+
+template<typename T>
+std::shared_mutex Manager<T>::_Mutex;
+
+template<typename T>
+typename Manager<T>::sizer Manager<T>::_Sizer;
+
+template<typename T>
+size_t Manager<T>::_Budget = 0;
+
+template<typename T>
+size_t Manager<T>::_BytesUsed = 0;
+
+template<typename T>
+size_t Manager<T>::_ClockHand = 0;
+
+template<typename T>
+std::atomic<size_t> Manager<T>::_Hits(0);
+
+template<typename T>
+std::atomic<size_t> Manager<T>::_Misses(0);
+
+template<typename T>
+size_t Manager<T>::_Evictions = 0;
 
 }
@@ -0,0 +1,156 @@
+#pragma once
+#include <vector>
+#include <unordered_map>
+#include <stdlib.h>
+
+namespace TChapman500 {
+namespace Elo {
+
+// Players waiting for a match, bucketed by rating.  The best opponent is the one whose expected
+// score against the player is closest to 50%, which for Elo is simply the closest rating, so a
+// search only has to walk outward from the player's own bucket until no closer rating is
+// possible.  The acceptable rating difference starts at BaseWindow and widens by WindowGrowth
+// per second of waiting, up to MaxWindow.  Both players' windows must accept the match.
+class match_queue
+{
+public:
+	static constexpr unsigned InvalidPlayer = ~0U;
+
+	inline match_queue(int minRating = 0, int maxRating = 4000, int bucketWidth = 25)
+	{
+		MinRating = minRating;
+		BucketWidth = bucketWidth > 0 ? bucketWidth : 1;
+		Buckets.resize((size_t)((maxRating - minRating) / BucketWidth) + 1);
+	}
+
+	double BaseWindow = 50.0;
+	double WindowGrowth = 10.0;
+	double MaxWindow = 400.0;
+
+	// Time is in seconds from whatever clock the caller uses.
+	inline bool add(unsigned player, int rating, double time)
+	{
+		if (Locations.find(player) != Locations.end()) return false;
+
+		size_t bucket = bucket_index(rating);
+		waiter newWaiter;
+		newWaiter.Player = player;
+		newWaiter.Rating = rating;
+		newWaiter.Time = time;
+		Buckets[bucket].push_back(newWaiter);
+
+		location newLocation;
+		newLocation.Bucket = bucket;
+		newLocation.Index = Buckets[bucket].size() - 1;
+		Locations[player] = newLocation;
+		return true;
+	}
+
+	inline bool remove(unsigned player)
+	{
+		std::unordered_map<unsigned, location>::iterator found = Locations.find(player);
+		if (found == Locations.end()) return false;
+
+		// Swap the last waiter of the bucket into the hole.
+		std::vector<waiter> &bucket = Buckets[found->second.Bucket];
+		size_t index = found->second.Index;
+		if (index + 1 != bucket.size())
+		{
+			bucket[index] = bucket.back();
+			Locations[bucket[index].Player].Index = index;
+		}
+		bucket.pop_back();
+		Locations.erase(found);
+		return true;
+	}
+
+	inline size_t size() const { return Locations.size(); }
+
+	// The window of a player who has waited since the given time.
+	inline double window(double since, double now) const
+	{
+		double result = BaseWindow + WindowGrowth * (now - since);
+		return result < MaxWindow ? result : MaxWindow;
+	}
+
+	// Best opponent for a waiting player, or InvalidPlayer if nobody fits.
+	inline unsigned find_opponent(unsigned player, double now) const
+	{
+		std::unordered_map<unsigned, location>::const_iterator found = Locations.find(player);
+		if (found == Locations.end()) return InvalidPlayer;
+
+		const waiter &self = Buckets[found->second.Bucket][found->second.Index];
+		double limit = window(self.Time, now);
+
+		unsigned result = InvalidPlayer;
+		int bestDistance = 0;
+		size_t center = found->second.Bucket;
+		for (size_t step = 0; ; step++)
+		{
+			// Nothing in buckets this far away can be closer than what we already have.
+			int nearest = step == 0 ? 0 : (int)(step - 1) * BucketWidth + 1;
+			if (nearest > limit || (result != InvalidPlayer && nearest > bestDistance)) break;
+			if (step > center && center + step >= Buckets.size()) break;
+
+			for (int side = 0; side < (step == 0 ? 1 : 2); side++)
+			{
+				if (side == 0 && step > center) continue;
+				size_t bucket = side == 0 ? center - step : center + step;
+				if (bucket >= Buckets.size()) continue;
+
+				for (const waiter &other : Buckets[bucket])
+				{
+					if (other.Player == player) continue;
+
+					int distance = abs(other.Rating - self.Rating);
+					if (distance > limit || distance > window(other.Time, now)) continue;
+					if (result != InvalidPlayer && distance >= bestDistance) continue;
+
+					result = other.Player;
+					bestDistance = distance;
+				}
+			}
+		}
+
+		return result;
+	}
+
+	// Find an opponent and take both players out of the queue.
+	inline bool match(unsigned player, double now, unsigned &opponent)
+	{
+		opponent = find_opponent(player, now);
+		if (opponent == InvalidPlayer) return false;
+
+		remove(player);
+		remove(opponent);
+		return true;
+	}
+
+private:
+	struct waiter
+	{
+		unsigned Player;
+		int Rating;
+		double Time;
+	};
+
+	struct location
+	{
+		size_t Bucket;
+		size_t Index;
+	};
+
+	inline size_t bucket_index(int rating) const
+	{
+		if (rating <= MinRating) return 0;
+		size_t result = (size_t)((rating - MinRating) / BucketWidth);
+		return result < Buckets.size() ? result : Buckets.size() - 1;
+	}
+
+	int MinRating;
+	int BucketWidth;
+	std::vector<std::vector<waiter>> Buckets;
+	std::unordered_map<unsigned, location> Locations;
+};
+
+}}
@@ -49,17 +49,30 @@ void StateMachine::Execute(IState *context)
 	// Initailize the new state
 	if (_NewState)
 	{
+#ifdef TC500_STATE_MACHINE_PROFILING
+		// The old state has already been swapped for the null state if it cleaned up last tick.
+		StateProfiler::RecordTransition(this, _PreviousState ? _PreviousState : _State.get(), _NewState.get());
+		_PreviousState = nullptr;
+#endif
 		_State = _NewState;
 		_State->Initialize(this);
 		_NewState = nullptr;
 	}
 	
 	// Execute the current state
-	_State->Execute(this);
+	{
+#ifdef TC500_STATE_MACHINE_PROFILING
+		StateProfiler::execute_scope scope(_State.get());
+#endif
+		_State->Execute(this);
+	}
 	
 	// Clean up old state
 	if (_NewState)
 	{
+#ifdef TC500_STATE_MACHINE_PROFILING
+		_PreviousState = _State.get();
+#endif
 		_State->CleanUp(this);
 		_State = _NullState;
 	}
@@ -127,7 +140,13 @@ void StateMachineEx::Execute(IState *context)
 	StateMachine::Execute(this);
 	
 	// Execute child state machines
-	for (const pair<shared_ptr<IState>, int> &child : _Children) child.first->Execute(this);
+	for (const pair<shared_ptr<IState>, int> &child : _Children)
+	{
+#ifdef TC500_STATE_MACHINE_PROFILING
+		StateProfiler::execute_scope scope(child.first.get());
+#endif
+		child.first->Execute(this);
+	}
 	
 	// Remove children
 	if (!_RemovedChildren.empty())
@@ -296,4 +315,109 @@ bool StateMachineEx::MoveChild(shared_ptr<IState> child, int order)
 	return false;
 }
 
+#ifdef TC500_STATE_MACHINE_PROFILING
+std::mutex StateProfiler::_Mutex;
+std::unordered_map<IState *, StateProfiler::state_profile> StateProfiler::_Profiles;
+StateProfiler::state_transition StateProfiler::_Trace[TC500_STATE_TRACE_SIZE];
+size_t StateProfiler::_TraceStart = 0;
+size_t StateProfiler::_TraceCount = 0;
+std::chrono::steady_clock::time_point StateProfiler::_Start = std::chrono::steady_clock::now();
+
+void StateProfiler::SetName(IState *state, std::string name)
+{
+	std::lock_guard<std::mutex> lock(_Mutex);
+	_Profiles[state].Name = name;
+}
+
+void StateProfiler::RecordTransition(IState *machine, IState *from, IState *to)
+{
+	std::lock_guard<std::mutex> lock(_Mutex);
+	_Profiles[from].TransitionsOut++;
+	_Profiles[to].TransitionsIn++;
+
+	// Overwrite the oldest transition once the trace is full.
+	size_t index = (_TraceStart + _TraceCount) % TC500_STATE_TRACE_SIZE;
+	if (_TraceCount < TC500_STATE_TRACE_SIZE) _TraceCount++;
+	else _TraceStart = (_TraceStart + 1) % TC500_STATE_TRACE_SIZE;
+
+	_Trace[index].Machine = machine;
+	_Trace[index].From = from;
+	_Trace[index].To = to;
+	_Trace[index].Time = std::chrono::duration<double>(std::chrono::steady_clock::now() - _Start).count();
+}
+
+bool StateProfiler::GetProfile(IState *state, state_profile &profile)
+{
+	std::lock_guard<std::mutex> lock(_Mutex);
+	std::unordered_map<IState *, state_profile>::const_iterator found = _Profiles.find(state);
+	if (found == _Profiles.end()) return false;
+	profile = found->second;
+	return true;
+}
+
+std::unordered_map<IState *, StateProfiler::state_profile> StateProfiler::GetProfiles()
+{
+	std::lock_guard<std::mutex> lock(_Mutex);
+	return _Profiles;
+}
+
+size_t StateProfiler::GetTraceCount()
+{
+	std::lock_guard<std::mutex> lock(_Mutex);
+	return _TraceCount;
+}
+
+StateProfiler::state_transition StateProfiler::GetTrace(size_t index)
+{
+	std::lock_guard<std::mutex> lock(_Mutex);
+	return _Trace[(_TraceStart + index) % TC500_STATE_TRACE_SIZE];
+}
+
+void StateProfiler::Reset()
+{
+	std::lock_guard<std::mutex> lock(_Mutex);
+
+	// Keep the names, but clear everything else.
+	for (std::pair<IState *const, state_profile> &profile : _Profiles)
+	{
+		profile.second.ExecuteCount = 0;
+		profile.second.TransitionsIn = 0;
+		profile.second.TransitionsOut = 0;
+		profile.second.TotalTime = 0.0;
+		profile.second.MaxTime = 0.0;
+	}
+	_TraceStart = 0;
+	_TraceCount = 0;
+	_Start = std::chrono::steady_clock::now();
+}
+
+void StateProfiler::Export(std::ostream &stream)
+{
+	std::lock_guard<std::mutex> lock(_Mutex);
+	stream << "state,name,executes,total_seconds,max_seconds,transitions_in,transitions_out\n";
+	for (const std::pair<IState *const, state_profile> &profile : _Profiles)
+	{
+		const state_profile &data = profile.second;
+		stream << (const void *)profile.first << ',' << data.Name << ',' << data.ExecuteCount << ',' << data.TotalTime << ',' << data.MaxTime << ',' << data.TransitionsIn << ',' << data.TransitionsOut << '\n';
+	}
+
+	stream << "\ntime_seconds,machine,from,to\n";
+	for (size_t i = 0; i < _TraceCount; i++)
+	{
+		const state_transition &transition = _Trace[(_TraceStart + i) % TC500_STATE_TRACE_SIZE];
+		stream << transition.Time << ',' << (const void *)transition.Machine << ',' << (const void *)transition.From << ',' << (const void *)transition.To << '\n';
+	}
+}
+
+void StateProfiler::_RecordExecute(IState *state, std::chrono::steady_clock::duration time)
+{
+	double seconds = std::chrono::duration<double>(time).count();
+	std::lock_guard<std::mutex> lock(_Mutex);
+	state_profile &profile = _Profiles[state];
+	profile.ExecuteCount++;
+	profile.TotalTime += seconds;
+	if (seconds > profile.MaxTime) profile.MaxTime = seconds;
+}
+#endif
+
 }
\ No newline at end of file
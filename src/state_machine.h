@@ -1,6 +1,21 @@
 #include <memory>
 #include <vector>
 
+// Define TC500_STATE_MACHINE_PROFILING to record execute times and transitions of every state
+// run by a StateMachine or StateMachineEx.  Nothing is recorded when it is not defined.
+#ifdef TC500_STATE_MACHINE_PROFILING
+#include <chrono>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+
+// Number of transitions kept by the trace.
+#ifndef TC500_STATE_TRACE_SIZE
+#define TC500_STATE_TRACE_SIZE 256
+#endif
+#endif
+
 namespace TChapman500
 {
 	class IState
@@ -44,6 +59,9 @@ namespace TChapman500
 		static std::shared_ptr<NullState> _NullState;
 		std::shared_ptr<IState> _State;
 		std::shared_ptr<IState> _NewState;
+#ifdef TC500_STATE_MACHINE_PROFILING
+		IState *_PreviousState = nullptr;
+#endif
 	};
 	
 	class StateMachineEx : public StateMachine
@@ -68,5 +86,68 @@ namespace TChapman500
 		std::vector<std::pair<std::shared_ptr<IState>, int>> _ReorderedChildren;
 		std::vector<std::pair<std::shared_ptr<IState>, int>> _RemovedChildren;
 	};
+
+#ifdef TC500_STATE_MACHINE_PROFILING
+	class StateProfiler
+	{
+	public:
+		struct state_profile
+		{
+			std::string Name;
+			unsigned long long ExecuteCount;
+			unsigned long long TransitionsIn;
+			unsigned long long TransitionsOut;
+			double TotalTime;	// Seconds, including any nested states.
+			double MaxTime;		// Longest single execute in seconds.
+		};
+
+		struct state_transition
+		{
+			IState *Machine;
+			IState *From;
+			IState *To;
+			double Time;		// Seconds since the profiler was created or reset.
+		};
+
+		// Times a single execute of a state.
+		class execute_scope
+		{
+		public:
+			inline execute_scope(IState *state) : _State(state), _Start(std::chrono::steady_clock::now()) {}
+			inline ~execute_scope() { StateProfiler::_RecordExecute(_State, std::chrono::steady_clock::now() - _Start); }
+
+		private:
+			IState *_State;
+			std::chrono::steady_clock::time_point _Start;
+		};
+
+		static void SetName(IState *state, std::string name);
+		static void RecordTransition(IState *machine, IState *from, IState *to);
+
+		// State machines may run on several threads, so everything is returned as a copy.
+		static bool GetProfile(IState *state, state_profile &profile);
+		static std::unordered_map<IState *, state_profile> GetProfiles();
+
+		// Transitions are returned oldest first.
+		static size_t GetTraceCount();
+		static state_transition GetTrace(size_t index);
+
+		static void Reset();
+
+		// Writes the profiles and the trace as CSV.
+		static void Export(std::ostream &stream);
+
+	private:
+		static void _RecordExecute(IState *state, std::chrono::steady_clock::duration time);
+
+		// Guards everything below.
+		static std::mutex _Mutex;
+		static std::unordered_map<IState *, state_profile> _Profiles;
+		static state_transition _Trace[TC500_STATE_TRACE_SIZE];
+		static size_t _TraceStart;
+		static size_t _TraceCount;
+		static std::chrono::steady_clock::time_point _Start;
+	};
+#endif
 }
 
@@ -0,0 +1,146 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace TChapman500
+{
+	class thread_pool
+	{
+	public:
+		// A thread count of 0 uses one thread per hardware thread.
+		inline thread_pool(unsigned threadCount = 0)
+		{
+			if (threadCount == 0) threadCount = std::thread::hardware_concurrency();
+			if (threadCount == 0) threadCount = 1;
+
+			for (unsigned i = 0; i < threadCount; i++)
+				Threads.emplace_back(&thread_pool::worker, this);
+		}
+
+		inline ~thread_pool()
+		{
+			{
+				std::lock_guard<std::mutex> lock(Mutex);
+				Stopping = true;
+			}
+			Condition.notify_all();
+			for (std::thread &thread : Threads) thread.join();
+		}
+
+		thread_pool(const thread_pool &) = delete;
+		thread_pool &operator=(const thread_pool &) = delete;
+
+		// Pool shared by everything that does not need its own threads.
+		static inline thread_pool &shared()
+		{
+			static thread_pool pool;
+			return pool;
+		}
+
+		inline unsigned size() const { return (unsigned)Threads.size(); }
+
+		// Queue a task without waiting for it.
+		inline void run(std::function<void()> task)
+		{
+			{
+				std::lock_guard<std::mutex> lock(Mutex);
+				Tasks.push_back(std::move(task));
+			}
+			Condition.notify_one();
+		}
+
+		// Queue a task and get a future for its result.
+		template<typename F> inline std::future<typename std::invoke_result<F>::type> submit(F function)
+		{
+			typedef typename std::invoke_result<F>::type result_type;
+			std::shared_ptr<std::packaged_task<result_type()>> task = std::make_shared<std::packaged_task<result_type()>>(std::move(function));
+			std::future<result_type> result = task->get_future();
+			run([task]() { (*task)(); });
+			return result;
+		}
+
+		// Call function(begin, end) over [0, count) in chunks of at least minChunk and wait for
+		// all of them.  The calling thread works on chunks too, so this is safe to call from
+		// inside a task running on the same pool.
+		template<typename F> inline void parallel_for(size_t count, size_t minChunk, F function)
+		{
+			if (count == 0) return;
+			if (minChunk == 0) minChunk = 1;
+
+			// Aim for a few chunks per thread to even out the load.
+			size_t chunkSize = count / ((size_t)size() * 4);
+			if (chunkSize < minChunk) chunkSize = minChunk;
+			size_t chunkCount = (count + chunkSize - 1) / chunkSize;
+			if (chunkCount == 1)
+			{
+				function((size_t)0, count);
+				return;
+			}
+
+			struct shared_state
+			{
+				std::atomic<size_t> Next;
+				std::atomic<size_t> Done;
+				std::mutex Mutex;
+				std::condition_variable Condition;
+			};
+			std::shared_ptr<shared_state> state = std::make_shared<shared_state>();
+			state->Next = 0;
+			state->Done = 0;
+
+			// Takes chunks until there are none left.  Helpers that start late find nothing to do.
+			std::function<void()> work = [state, count, chunkSize, chunkCount, &function]() {
+				size_t chunk;
+				while ((chunk = state->Next.fetch_add(1)) < chunkCount)
+				{
+					size_t begin = chunk * chunkSize;
+					size_t end = begin + chunkSize < count ? begin + chunkSize : count;
+					function(begin, end);
+					if (state->Done.fetch_add(1) + 1 == chunkCount)
+					{
+						std::lock_guard<std::mutex> lock(state->Mutex);
+						state->Condition.notify_all();
+					}
+				}
+			};
+
+			size_t helpers = chunkCount - 1 < size() ? chunkCount - 1 : size();
+			for (size_t i = 0; i < helpers; i++) run(work);
+			work();
+
+			std::unique_lock<std::mutex> lock(state->Mutex);
+			state->Condition.wait(lock, [&state, chunkCount]() { return state->Done.load() == chunkCount; });
+		}
+
+	private:
+		inline void worker()
+		{
+			while (true)
+			{
+				std::function<void()> task;
+				{
+					std::unique_lock<std::mutex> lock(Mutex);
+					Condition.wait(lock, [this]() { return Stopping || !Tasks.empty(); });
+					if (Tasks.empty()) return;
+					task = std::move(Tasks.front());
+					Tasks.pop_front();
+				}
+				task();
+			}
+		}
+
+		std::vector<std::thread> Threads;
+		std::deque<std::function<void()>> Tasks;
+		std::mutex Mutex;
+		std::condition_variable Condition;
+		bool Stopping = false;
+	};
+}
@@ -0,0 +1,278 @@
+// Compresses a synthetic image with CompressTexture(), decodes the blocks with a plain BC1/BC3
+// decoder written from the format description, and checks the quality against fixed floors.
+// Pixels under alpha 128 must decode as transparent in DXT1, and no others may.  Build and
+// run with:
+//   cl /std:c++17 /O2 /EHsc block_compression_test.cpp ..\src\Graphics\BlockCompression.cpp ..\src\Graphics\Mipmaps.cpp
+#include "../src/Graphics/BlockCompression.h"
+#include "../src/Graphics/Mipmaps.h"
+#include <math.h>
+#include <stdio.h>
+
+using namespace TChapman500::Graphics;
+
+static int failures = 0;
+
+static void CheckAtLeast(const char *name, double value, double floor)
+{
+	bool pass = value >= floor;
+	if (!pass) failures++;
+	printf("%s %s: %.2f (at least %.2f)\n", pass ? "PASS" : "FAIL", name, value, floor);
+}
+
+static void CheckEqual(const char *name, unsigned value, unsigned expected)
+{
+	bool pass = value == expected;
+	if (!pass) failures++;
+	printf("%s %s: %u (expected %u)\n", pass ? "PASS" : "FAIL", name, value, expected);
+}
+
+// Same numbers on every compiler, unlike rand().
+static unsigned Random(unsigned &seed)
+{
+	seed = seed * 1664525u + 1013904223u;
+	return seed >> 16;
+}
+
+static unsigned char Clamp(double value)
+{
+	return value < 0.0 ? 0 : value > 255.0 ? 255 : (unsigned char)value;
+}
+
+enum class alpha_kind { Opaque, Soft, Hard };
+
+// Smooth gradients with a little noise, and solid patches with hard edges.
+static bool MakeImage(texture_data &texture, unsigned width, unsigned height, alpha_kind alpha)
+{
+	texture.initialize(1, 1);
+	if (!texture.Mips) return false;
+	texture.Width = width;
+	texture.Height = height;
+	texture.Format = texture_format::RGBA_8888;
+	texture.CubeMap = false;
+	texture.Transparent = alpha != alpha_kind::Opaque;
+	texture.Mips[0].Width = width;
+	texture.Mips[0].Height = height;
+	texture.Mips[0].BytesPerRow = width * 4;
+	texture.Mips[0].DataSize = width * height * 4;
+	if (!texture.generate_data()) return false;
+
+	unsigned seed = 5;
+	unsigned char *pixels = texture.get_data(0, 0);
+	for (unsigned y = 0; y < height; y++)
+	{
+		for (unsigned x = 0; x < width; x++)
+		{
+			unsigned char *pixel = pixels + ((size_t)y * width + x) * 4;
+			double fx = x / (double)width;
+			double fy = y / (double)height;
+			double r = 128.0 + 100.0 * sin(fx * 9.0 + fy * 3.0) + (double)(Random(seed) % 9) - 4.0;
+			double g = 128.0 + 90.0 * cos(fx * 5.0 - fy * 11.0) + (double)(Random(seed) % 9) - 4.0;
+			double b = 128.0 + 110.0 * sin((fx + fy) * 7.0) * cos(fy * 4.0);
+			if ((x / 37 + y / 23) % 5 == 0)
+			{
+				r = 250.0;
+				g = 40.0;
+				b = 30.0;
+			}
+			pixel[0] = Clamp(r);
+			pixel[1] = Clamp(g);
+			pixel[2] = Clamp(b);
+			switch (alpha)
+			{
+			case alpha_kind::Opaque: pixel[3] = 255; break;
+			case alpha_kind::Soft: pixel[3] = Clamp(128.0 + 127.0 * sin(fx * 13.0) * cos(fy * 7.0)); break;
+			case alpha_kind::Hard: pixel[3] = (x / 5 + y / 3) % 3 == 0 ? 0 : 255; break;
+			}
+		}
+	}
+	return true;
+}
+
+static void Decode565(unsigned color, int *rgb)
+{
+	int r = (color >> 11) & 31;
+	int g = (color >> 5) & 63;
+	int b = color & 31;
+	rgb[0] = (r << 3) | (r >> 2);
+	rgb[1] = (g << 2) | (g >> 4);
+	rgb[2] = (b << 3) | (b >> 2);
+}
+
+// The color half of a block, as RGBA.  DXT5 colors always use the four-color mode.
+static void DecodeColor(const unsigned char *block, unsigned char *pixels, bool alwaysFourColors)
+{
+	unsigned color0 = block[0] | block[1] << 8;
+	unsigned color1 = block[2] | block[3] << 8;
+	int palette[4][4];
+	Decode565(color0, palette[0]);
+	Decode565(color1, palette[1]);
+
+	bool fourColors = alwaysFourColors || color0 > color1;
+	for (int c = 0; c < 3; c++)
+	{
+		if (fourColors)
+		{
+			palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+			palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+		}
+		else
+		{
+			palette[2][c] = (palette[0][c] + palette[1][c]) / 2;
+			palette[3][c] = 0;
+		}
+	}
+	palette[0][3] = palette[1][3] = palette[2][3] = 255;
+	palette[3][3] = fourColors ? 255 : 0;
+
+	unsigned indices = block[4] | block[5] << 8 | block[6] << 16 | (unsigned)block[7] << 24;
+	for (int i = 0; i < 16; i++)
+	{
+		int index = (indices >> (2 * i)) & 3;
+		for (int c = 0; c < 4; c++) pixels[i * 4 + c] = (unsigned char)palette[index][c];
+	}
+}
+
+// The alpha half of a DXT5 block, into the alpha of each RGBA pixel.
+static void DecodeAlpha(const unsigned char *block, unsigned char *pixels)
+{
+	int alpha[8];
+	alpha[0] = block[0];
+	alpha[1] = block[1];
+	if (alpha[0] > alpha[1])
+	{
+		for (int i = 2; i < 8; i++) alpha[i] = ((8 - i) * alpha[0] + (i - 1) * alpha[1]) / 7;
+	}
+	else
+	{
+		for (int i = 2; i < 6; i++) alpha[i] = ((6 - i) * alpha[0] + (i - 1) * alpha[1]) / 5;
+		alpha[6] = 0;
+		alpha[7] = 255;
+	}
+
+	unsigned long long indices = 0;
+	for (int i = 0; i < 6; i++) indices |= (unsigned long long)block[2 + i] << (8 * i);
+	for (int i = 0; i < 16; i++) pixels[i * 4 + 3] = (unsigned char)alpha[(indices >> (3 * i)) & 7];
+}
+
+static double PSNR(double squaredError, double samples)
+{
+	return squaredError == 0.0 ? 99.0 : 10.0 * log10(255.0 * 255.0 * samples / squaredError);
+}
+
+struct quality_result
+{
+	double Color;
+	double Alpha;
+	unsigned PunchThroughErrors;
+};
+
+// Decode every mip of dest and compare it with source.  Transparent DXT1 pixels only count
+// towards punch-through errors, since their color is thrown away.
+static quality_result Measure(texture_data &source, texture_data &dest)
+{
+	bool dxt1 = dest.Format == texture_format::DXT1;
+	unsigned blockSize = dxt1 ? 8 : 16;
+	double colorError = 0.0, alphaError = 0.0, samples = 0.0;
+	quality_result result = {};
+
+	for (unsigned mip = 0; mip < source.MipCount; mip++)
+	{
+		unsigned width = source.Mips[mip].Width;
+		unsigned height = source.Mips[mip].Height;
+		const unsigned char *original = source.get_data(mip, 0);
+		const unsigned char *blocks = dest.get_data(mip, 0);
+		for (unsigned blockY = 0; blockY < (height + 3) / 4; blockY++)
+		{
+			for (unsigned blockX = 0; blockX < (width + 3) / 4; blockX++)
+			{
+				const unsigned char *block = blocks + blockY * dest.Mips[mip].BytesPerRow + blockX * blockSize;
+				unsigned char decoded[64];
+				if (dxt1) DecodeColor(block, decoded, false);
+				else
+				{
+					DecodeColor(block + 8, decoded, true);
+					DecodeAlpha(block, decoded);
+				}
+
+				for (unsigned y = 0; y < 4; y++)
+				{
+					for (unsigned x = 0; x < 4; x++)
+					{
+						unsigned column = blockX * 4 + x, row = blockY * 4 + y;
+						if (column >= width || row >= height) continue;
+						const unsigned char *expected = original + ((size_t)row * width + column) * 4;
+						const unsigned char *actual = decoded + (y * 4 + x) * 4;
+						if (dxt1 && source.Transparent)
+						{
+							bool transparent = expected[3] < 128;
+							if (transparent != (actual[3] == 0)) result.PunchThroughErrors++;
+							if (transparent) continue;
+						}
+						for (int c = 0; c < 3; c++) colorError += (double)(expected[c] - actual[c]) * (expected[c] - actual[c]);
+						if (!dxt1) alphaError += (double)(expected[3] - actual[3]) * (expected[3] - actual[3]);
+						samples++;
+					}
+				}
+			}
+		}
+	}
+	result.Color = PSNR(colorError, samples * 3.0);
+	result.Alpha = PSNR(alphaError, samples);
+	return result;
+}
+
+static bool Compress(const char *name, texture_data &source, texture_data &dest, texture_format format, compression_quality quality, quality_result &result)
+{
+	if (!CompressTexture(source, dest, format, quality))
+	{
+		failures++;
+		printf("FAIL %s: CompressTexture() failed\n", name);
+		return false;
+	}
+	result = Measure(source, dest);
+	return true;
+}
+
+int main()
+{
+	texture_data opaque, soft, hard;
+	if (!MakeImage(opaque, 1027, 771, alpha_kind::Opaque) || !GenerateMips(opaque) || !MakeImage(soft, 512, 512, alpha_kind::Soft) || !MakeImage(hard, 256, 250, alpha_kind::Hard))
+	{
+		printf("FAIL could not make the test images\n");
+		return 1;
+	}
+
+	// The same dest is used for every run, so each one must free what the last one left.
+	texture_data dest;
+	quality_result result;
+
+	if (Compress("BC1 fast", opaque, dest, texture_format::DXT1, compression_quality::Fast, result))
+		CheckAtLeast("BC1 fast, with mips", result.Color, 36.5);
+
+	if (Compress("BC1 high", opaque, dest, texture_format::DXT1, compression_quality::High, result))
+		CheckAtLeast("BC1 high, with mips", result.Color, 39.0);
+
+	if (Compress("BC3 fast", soft, dest, texture_format::DXT5, compression_quality::Fast, result))
+	{
+		CheckAtLeast("BC3 fast, soft alpha, color", result.Color, 38.5);
+		CheckAtLeast("BC3 fast, soft alpha, alpha", result.Alpha, 62.5);
+	}
+
+	if (Compress("BC3 high", soft, dest, texture_format::DXT5, compression_quality::High, result))
+	{
+		CheckAtLeast("BC3 high, soft alpha, color", result.Color, 40.8);
+		CheckAtLeast("BC3 high, soft alpha, alpha", result.Alpha, 62.5);
+	}
+
+	if (Compress("BC1 fast", hard, dest, texture_format::DXT1, compression_quality::Fast, result))
+		CheckEqual("BC1 fast punch-through errors", result.PunchThroughErrors, 0);
+
+	if (Compress("BC1 high", hard, dest, texture_format::DXT1, compression_quality::High, result))
+		CheckEqual("BC1 high punch-through errors", result.PunchThroughErrors, 0);
+
+	// A texture cannot be compressed into itself.
+	CheckEqual("Compress into source", CompressTexture(soft, soft, texture_format::DXT5) ? 1 : 0, 0);
+
+	if (failures) printf("%d checks failed\n", failures);
+	return failures ? 1 : 0;
+}
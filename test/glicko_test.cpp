@@ -0,0 +1,34 @@
+// Checks update_period() against the worked example in Glickman's "Example of the Glicko-2
+// system".  Build and run with:  g++ -std=c++17 -O2 glicko_test.cpp -o glicko_test
+#include "../src/glicko.h"
+#include <math.h>
+#include <stdio.h>
+
+using namespace TChapman500;
+
+static int failures = 0;
+
+static void Check(const char *name, double value, double expected, double tolerance)
+{
+	bool pass = fabs(value - expected) <= tolerance;
+	if (!pass) failures++;
+	printf("%s %s: %.6f (expected %.6f)\n", pass ? "PASS" : "FAIL", name, value, expected);
+}
+
+int main()
+{
+	// Player 0 is rated 1500 / 200 / 0.06.  They beat a 1400 / 30 player, then lose to a
+	// 1550 / 100 player and a 1700 / 300 player.  tau is 0.5.
+	double rating[4] = { 1500.0, 1400.0, 1550.0, 1700.0 };
+	double deviation[4] = { 200.0, 30.0, 100.0, 300.0 };
+	double volatility[4] = { 0.06, 0.06, 0.06, 0.06 };
+	unsigned player1[3] = { 0, 0, 0 };
+	unsigned player2[3] = { 1, 2, 3 };
+	double score1[3] = { 1.0, 0.0, 0.0 };
+	Glicko2::update_period(rating, deviation, volatility, 4, player1, player2, score1, 3, 0.5);
+
+	Check("rating", rating[0], 1464.06, 0.01);
+	Check("deviation", deviation[0], 151.52, 0.01);
+	Check("volatility", volatility[0], 0.05999, 0.00001);
+	return failures ? 1 : 0;
+}
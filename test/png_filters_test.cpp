@@ -0,0 +1,124 @@
+// Checks that the vector PNG kernels match their plain versions byte for byte.  Every filter
+// and pixel size is run on random rows of every width from 1 to 64 pixels, as are the expand
+// and 16-bit scaling kernels.  Build with the widest instruction set the target has, so every
+// vector path is taken, and run with:
+//   g++ -std=c++17 -O2 -mavx2 png_filters_test.cpp ../src/Graphics/PNGFilters.cpp -o png_filters_test
+#include "../src/Graphics/PNGFilters.h"
+#include <stdio.h>
+#include <string.h>
+#include <random>
+#include <vector>
+
+using namespace TChapman500::Graphics;
+
+static int failures = 0;
+static int checks = 0;
+static std::mt19937 rng(500);
+
+// Room past the end of each buffer, to catch kernels that write too far.
+static const size_t Slack = 64;
+
+static void Fill(std::vector<unsigned char> &buffer)
+{
+	for (unsigned char &byte : buffer) byte = (unsigned char)rng();
+}
+
+static void Compare(const char *kernel, size_t width, size_t bytesPerPixel, const std::vector<unsigned char> &vector, const std::vector<unsigned char> &scalar)
+{
+	checks++;
+	if (vector.size() == scalar.size() && memcmp(vector.data(), scalar.data(), vector.size()) == 0) return;
+	failures++;
+	printf("FAIL %s: width %zu, %zu bytes per pixel\n", kernel, width, bytesPerPixel);
+}
+
+static void TestUnfilter()
+{
+	static const char *names[] = { "None", "Sub", "Up", "Average", "Paeth" };
+	static const size_t sizes[] = { 1, 2, 3, 4, 6, 8 };
+	for (unsigned char filter = 0; filter < 5; filter++)
+	{
+		for (size_t bytesPerPixel : sizes)
+		{
+			for (size_t width = 1; width <= 64; width++)
+			{
+				size_t length = width * bytesPerPixel;
+				std::vector<unsigned char> previous(length), row(length + Slack);
+				Fill(previous);
+				Fill(row);
+
+				std::vector<unsigned char> vector = row, scalar = row;
+				UnfilterScanline(filter, vector.data(), previous.data(), length, bytesPerPixel);
+				UnfilterScanlineScalar(filter, scalar.data(), previous.data(), length, bytesPerPixel);
+				Compare(names[filter], width, bytesPerPixel, vector, scalar);
+			}
+		}
+	}
+}
+
+template<typename F> static void TestExpand(const char *name, size_t bytesPerPixel, F vectorKernel, F scalarKernel)
+{
+	for (size_t width = 1; width <= 64; width++)
+	{
+		std::vector<unsigned char> source(width * bytesPerPixel);
+		Fill(source);
+
+		// Both destinations start with the same junk, so bytes the kernels skip compare equal.
+		std::vector<unsigned char> vector(width * 4 + Slack);
+		Fill(vector);
+		std::vector<unsigned char> scalar = vector;
+		vectorKernel(vector.data(), source.data(), width);
+		scalarKernel(scalar.data(), source.data(), width);
+		Compare(name, width, bytesPerPixel, vector, scalar);
+	}
+}
+
+static void TestPalette()
+{
+	unsigned palette[256];
+	for (unsigned &color : palette) color = (unsigned)rng();
+	for (size_t width = 1; width <= 64; width++)
+	{
+		std::vector<unsigned char> source(width);
+		Fill(source);
+
+		std::vector<unsigned char> vector(width * 4 + Slack);
+		Fill(vector);
+		std::vector<unsigned char> scalar = vector;
+		ExpandPalette(vector.data(), source.data(), width, palette);
+		ExpandPaletteScalar(scalar.data(), source.data(), width, palette);
+		Compare("ExpandPalette", width, 1, vector, scalar);
+	}
+}
+
+static void TestScale16()
+{
+	for (size_t count = 1; count <= 64 * 4; count++)
+	{
+		std::vector<unsigned char> source(count * 2);
+		Fill(source);
+
+		std::vector<unsigned char> vector(count + Slack);
+		Fill(vector);
+		std::vector<unsigned char> scalar = vector;
+		ScaleSamples16(vector.data(), source.data(), count);
+		ScaleSamples16Scalar(scalar.data(), source.data(), count);
+		Compare("ScaleSamples16", count, 2, vector, scalar);
+	}
+}
+
+int main()
+{
+	// Several passes, so each width sees more than one random row.
+	for (int pass = 0; pass < 8; pass++)
+	{
+		TestUnfilter();
+		TestExpand("ExpandRGB", 3, ExpandRGB, ExpandRGBScalar);
+		TestExpand("ExpandGray", 1, ExpandGray, ExpandGrayScalar);
+		TestExpand("ExpandGrayAlpha", 2, ExpandGrayAlpha, ExpandGrayAlphaScalar);
+		TestPalette();
+		TestScale16();
+	}
+
+	printf("%d of %d checks failed\n", failures, checks);
+	return failures ? 1 : 0;
+}